@@ -14,3 +14,12 @@ AR		:= ar
 
 ASFLAGS	+= -g
 CFLAGS 	+= $(ASFLAGS) -DDEBUG=1
+
+# Size of the task table. Every task has its own page directory, with all
+# of the linear space above KERNEL_SPACE (include/linux/sched.h) to itself,
+# whatever NR_TASKS is. The GDT in boot/head.s is sized from it: 4 + 2 *
+# NR_TASKS descriptors, and a GDT holds at most 8192. Max is 4094.
+NR_TASKS	:= 64
+
+CFLAGS	+= -DNR_TASKS=$(NR_TASKS)
+ASFLAGS	+= --defsym NR_TASKS=$(NR_TASKS)
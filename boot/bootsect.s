@@ -37,6 +37,10 @@
 #.equ ROOT_DEV, 0x306
 .equ ROOT_DEV, 0x301
 
+# BOOT_FLAGS:   boot-time options for the kernel, see linux/config.h
+#               0x001 - use PCI IDE bus-master DMA for the hard disk
+.equ BOOT_FLAGS, 0x000
+
 .global _start
 _start:
     ljmp $BOOTSEG, $start
@@ -273,7 +277,9 @@ msg1:
     .ascii "Loading system ..."
     .byte 13,10,13,10
 
-.org 508
+.org 506
+boot_flags:
+    .word BOOT_FLAGS
 root_dev:
     .word ROOT_DEV
 boot_flag:                      # the magic number stored at the end of the MBR
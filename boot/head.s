@@ -13,6 +13,15 @@
  * the page directory.
  */
 
+/*
+ * NR_TASKS comes from BUILD_CONFIG.mk (--defsym), and has to agree with
+ * include/linux/sched.h. The GDT holds a TSS and an LDT per task.
+ */
+.ifndef NR_TASKS
+.set NR_TASKS, 64
+.endif
+.set GDT_ENTRIES, 4+2*NR_TASKS
+
 .text
 .globl startup_32, idt, gdt, pg_dir, tmp_floppy_area
 
@@ -277,8 +286,8 @@ idt_descr:              # IDTR
 .p2align 2
 .word 0
 gdt_descr:
-    .word 256*8-1		# so does gdt (not that that's any
-    .long gdt		    # magic number, but it works for me :^)
+    .word GDT_ENTRIES*8-1   # 4 fixed entries + (tss, ldt) per task
+    .long gdt
 
 #.align 3
 .p2align 3
@@ -287,9 +296,9 @@ idt:   # Size: 2KB
 
 #.align 3
 .p2align 3
-gdt:	  # Size: 2KB
+gdt:	  # Size: GDT_ENTRIES*8 (2KB for 64 tasks, 8KB for 512)
     .quad 0x0000000000000000	  /* NULL descriptor */
-    .quad 0x00c09a0000000fff	  /* 16Mb */
-    .quad 0x00c0920000000fff	  /* 16Mb */
+    .quad 0x00cf9a000000ffff	  /* 4Gb: memory past 16Mb is */
+    .quad 0x00cf92000000ffff	  /* 4Gb: mapped by mem_init() */
     .quad 0x0000000000000000	  /* TEMPORARY - do not use */
-    .fill 252,8,0			          /* space for LDT's and TSS's etc */
+    .fill GDT_ENTRIES-4,8,0	      /* space for LDT's and TSS's etc */
@@ -41,6 +41,24 @@ _start:
     int  $0x15          # at address 1024KB. Remember not at 0
     movw %ax, 2
 
+# Get memory size past 16Mb too (0x901F0, 0x901F2), both 0 if the BIOS
+# can't tell: 1KB blocks between 1Mb and 16Mb, 64KB blocks above 16Mb
+
+    xorw %cx, %cx
+    xorw %dx, %dx
+    movw $0xe801, %ax
+    int  $0x15
+    jnc  e801_ok
+    xorw %ax, %ax
+    xorw %bx, %bx
+e801_ok:
+    jcxz e801_ax        # some BIOSes only answer in %ax/%bx
+    movw %cx, %ax
+    movw %dx, %bx
+e801_ax:
+    movw %ax, 0x1f0
+    movw %bx, 0x1f2
+
 # Get video-card data: (0x90004, 0x90006)
 
     movb $0x0f, %ah
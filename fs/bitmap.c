@@ -6,6 +6,7 @@
 
 /* bitmap.c contains the code that handles the inode and block bitmaps */
 #include <string.h>
+#include <sys/stat.h>
 
 #include <linux/sched.h>
 #include <linux/kernel.h>
@@ -50,75 +51,161 @@
         res; \
     })
 
-#define find_first_zero(addr) \
-    ({ \
-        int __res; \
-        __asm__ __volatile__("cld\n" \
-                             "1:\n\t" \
-                             "lodsl\n\t" \
-                             "notl %%eax\n\t" \
-                             "bsfl %%eax, %%edx\n\t" \
-                             "je 2f\n\t" \
-                             "addl %%edx, %%ecx\n\t" \
-                             "jmp 3f\n" \
-                             "2:\n\t" \
-                             "addl $32, %%ecx\n\t" \
-                             "cmpl $8192, %%ecx\n\t" \
-                             "jl 1b\n" \
-                             "3:\n\t" \
-                             : \
-                             "=c" (__res) \
-                             : \
-                             "c" (0), \
-                             "S" (addr) \
-                            ); \
-        __res; \
-    })
+/*
+ * Blocks are allocated near a goal, usually the zone after the file's
+ * previous block, so that files come out contiguous and are read without
+ * seeks. Without a goal the search goes on from where the last one on the
+ * device stopped (the cursors in the super block). Searches go round the
+ * end of the bitmap, back to where they started.
+ *
+ * A regular file that gets a new zone reserves the free ones right after
+ * it, PREALLOC_ZONES in all, and is given them as long as it goes on
+ * writing in sequence. If the goal isn't free, it gets a whole run of
+ * PREALLOC_ZONES free zones if there is one. The reserved zones are marked
+ * in the bitmap like used ones, and given back by discard_prealloc() when
+ * the last user of the inode goes.
+ */
+#define PREALLOC_ZONES 8
+
+/*
+ * Bitmap searches. A bitmap is the blocks of an i-node or zone map, nr_bits
+ * long, and a summary with a bit per block known to be all ones: searches
+ * pass such blocks by without touching them. A search that went through a
+ * whole block in vain sets its bit; free_block() and free_inode() clear it.
+ * Within a block, words of all ones (or all zeros) go by in a repe scasl.
+ */
+struct bitmap {
+    struct buffer_head** maps;
+    int nr_bits;
+    unsigned char* full;
+};
 
-int new_block(int dev)
+#define ZONE_BITS(sb) ((sb)->s_nzones - (sb)->s_firstdatazone + 1)
+#define ZMAP(sb) { (sb)->s_zmap, ZONE_BITS(sb), &(sb)->s_zmap_full }
+#define IMAP(sb) { (sb)->s_imap, (sb)->s_ninodes + 1, &(sb)->s_imap_full }
+
+#define FIND_ZERO (~0UL)    /* skip ones */
+#define FIND_ONE 0UL        /* skip zeros */
+
+/*
+ * The first bit at or after offset in a bitmap block that isn't what skip
+ * is made of, BLCK_BITS if none.
+ */
+static int find_next_bit(const char* addr, int offset, unsigned long skip)
 {
-    struct super_block* sb = get_super(dev);
-    if (!sb) panic("trying to get new block from nonexistant device");
-    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
-    struct buffer_head* bh;
-    int i, j;
+    const unsigned long* p = (const unsigned long*) addr + (offset >> 5);
+    unsigned long word = (*p ^ skip) & ~((1UL << (offset & 31)) - 1);
+    int left = BLCK_BITS / 32 - 1 - (offset >> 5);     // words after p
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    if (!word && left) {
+        __asm__ __volatile__("cld\n\t"
+                             "repe scasl\n\t"
+                             :
+                             "=D" (p),
+                             "=c" (left)
+                             :
+                             "a" (skip),
+                             "0" (p + 1),
+                             "1" (left)
+                             :
+                             "memory"
+                            );
+        word = *--p ^ skip;     // the word it stopped at
+    }
+    if (!word) return BLCK_BITS;
+    return (p - (const unsigned long*) addr) * 32 + __builtin_ctz(word);
+}
 
-    for (i = 0; i < sb->s_zmap_blocks; ++i) {
-        bh = sb->s_zmap[i];
-#ifdef DEBUG
-        if (!bh) {
-            printkc("new_block: Dev %#x: Filesystem is corrupted!\n", dev);
-            panic("new_block: Filesystem is corrupted!");
+/*
+ * The first zero (FIND_ZERO) or one (FIND_ONE) bit of map in [bit, end),
+ * end if none.
+ */
+static int next_bit(struct bitmap* map, int bit, int end, unsigned long skip)
+{
+    while (bit < end) {
+        int i = ZMAP_INDX(bit);
+        int j = BLCK_BITS;
+        //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+        if (skip != FIND_ZERO || !(*map->full & (1 << i))) {
+            j = find_next_bit(map->maps[i]->b_data, bit & BLCK_MASK, skip);
+            if (j == BLCK_BITS && skip == FIND_ZERO && !(bit & BLCK_MASK))
+                *map->full |= 1 << i;
         }
-#endif
-        j = find_first_zero(bh->b_data);        // TO_READ
-        if (j < BLCK_BITS) break;
-    }   // find the nr of the first emtpy zone
-    /***************************************************************/
-#ifdef DEBUG
-    if (j >= BLCK_BITS && i < sb->s_zmap_blocks) {
-        printkc("new_block: Something wrong with the bitmap searching!\n");
-        panic("new_block: Something wrong with the bitmap searching!");
+        if (j < BLCK_BITS) {
+            bit = i * BLCK_BITS + j;
+            return (bit < end) ? bit : end;
+        }
+        bit = (i + 1) * BLCK_BITS;
     }
-#endif
-    // the 0 zone is the boot block. If you get it, the disk is full.
-    if (i == sb->s_zmap_blocks) {
-#ifdef DEBUG
-        printkc("new_block: Dev %#x: run out of data zones!\n", dev);
-#endif
-        return 0;
+    return end;
+}
+
+/* the first run of len zero bits within [from, to), to if none */
+static int find_run(struct bitmap* map, int from, int to, int len)
+{
+    while ((from = next_bit(map, from, to, FIND_ZERO)) < to) {
+        int end = (from + len < to) ? from + len : to;
+        int one = next_bit(map, from, end, FIND_ONE);
+        if (one - from >= len) return from;
+        from = one;
     }
-    //////////////////////////////////////////////////////////////////////////
-    if (set_bit(j, bh->b_data)) panic("new_block: bit already set!");
-    bh->b_dirt = 1;
-    /***************************************************************/
-    // why -1 ? Check the debugging info in read_super()
-    j += i * BLCK_BITS + sb->s_firstdatazone - 1;
-    if (j >= sb->s_nzones) return 0;    // crutical!!!
+    return to;
+}
+
+/*
+ * A run of len zero bits from start on, or else from the beginning up to
+ * start: its first bit, 0 if there is none (bit 0 is always set).
+ */
+static int search_run(struct bitmap* map, int start, int len)
+{
+    if (start < 0 || start >= map->nr_bits) start = 0;
+    int bit = find_run(map, start, map->nr_bits, len);
+    if (bit < map->nr_bits) return bit;
     /***************************************************************/
+    int to = start + len - 1;
+    if (to > map->nr_bits) to = map->nr_bits;
+    bit = find_run(map, 0, to, len);
+    return (bit < to) ? bit : 0;
+}
+
+/* sets [bit, bit + len), which must be free */
+static void set_bits(struct bitmap* map, int bit, int len)
+{
+    for ( ; len--; ++bit) {
+        struct buffer_head* bh = map->maps[ZMAP_INDX(bit)];
+        if (set_bit(bit & BLCK_MASK, bh->b_data)) 
+            panic("set_bits: bit already set!");
+        bh->b_dirt = 1;
+    }
+}
+
+/* the zero bits below nr_bits of the bitmap blocks maps[] */
+int count_free(struct buffer_head** maps, int nr_bits)
+{
+    int free = 0;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    for (int bit = 0; bit < nr_bits; bit += 32) {
+        const unsigned long* p = (const unsigned long*) 
+                                 maps[ZMAP_INDX(bit)]->b_data;
+        unsigned long word = ~p[(bit & BLCK_MASK) >> 5];
+        if (nr_bits - bit < 32) word &= (1UL << (nr_bits - bit)) - 1;
+        for ( ; word; word &= word - 1) ++free;
+    }
+    return free;
+}
+
+// why -1 ? Check the debugging info in read_super()
+#define zone_bit(sb, zone) ((zone) - (sb)->s_firstdatazone + 1)
+#define bit_zone(sb, bit) ((bit) + (sb)->s_firstdatazone - 1)
+#define goal_bit(sb, goal) \
+    (((goal) >= (sb)->s_firstdatazone && (goal) < (sb)->s_nzones) ? \
+     zone_bit(sb, goal) : (sb)->s_zone_cursor)
+
+// a zone just allocated gets a zeroed buffer
+static int zero_zone(struct super_block* sb, int zone)
+{
     // getblk() here acutually finds a empty buffer block
-    bh = getblk(dev, j);
+    struct buffer_head* bh = getblk(sb->s_dev, zone);
     if (!bh || bh->b_count != 1) {
 #ifdef DEBUG
         printkc("new_block: Somthing wrong with the getblk!\n"
@@ -126,10 +213,10 @@ int new_block(int dev)
                 "Otherwise it will cause a filesystem inconsistency!\n");
 #endif
         /******************************************************/
-        struct buffer_head* tmp = sb->s_zmap[i];
-        j -= i * BLCK_BITS + sb->s_firstdatazone - 1;
+        int bit = zone_bit(sb, zone);
+        struct buffer_head* tmp = sb->s_zmap[ZMAP_INDX(bit)];
         /******************************************************/
-        if (clear_bit(j, tmp->b_data))
+        if (clear_bit(bit & BLCK_MASK, tmp->b_data))
             panic("new_block: bit already cleared!");
         /******************************************************/
         if (!bh) panic("new_block: cannot get block");
@@ -140,7 +227,90 @@ int new_block(int dev)
     bh->b_uptodate = 1;
     bh->b_dirt = 1;
     brelse(bh);
-    return j;
+    return zone;
+}
+
+/*
+ * A free zone as near after goal as there is, or after the last one got
+ * if goal is no data zone (0). Returns 0 if the disk is full.
+ */
+int new_block(int dev, int goal)
+{
+    struct super_block* sb = get_super(dev);
+    if (!sb) panic("trying to get new block from nonexistant device");
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    struct bitmap zmap = ZMAP(sb);
+    int bit = search_run(&zmap, goal_bit(sb, goal), 1);
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    // the 0 zone is the boot block. If you get it, the disk is full.
+    if (!bit) {
+#ifdef DEBUG
+        printkc("new_block: Dev %#x: run out of data zones!\n", dev);
+#endif
+        return 0;
+    }
+    set_bits(&zmap, bit, 1);
+    sb->s_zone_cursor = bit;
+    sb->s_free_zones--;
+    return zero_zone(sb, bit_zone(sb, bit));
+}
+
+/*
+ * new_block() for the data of inode: from its preallocated zones if goal
+ * is the next of them (or there is no goal), else near goal, preallocating
+ * afresh.
+ */
+int new_file_block(struct m_inode* inode, int goal)
+{
+    struct super_block* sb;
+    int zone;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    if (inode->i_prealloc_count) {
+        if (!goal || goal == inode->i_prealloc_zone) {
+            if (!(sb = get_super(inode->i_dev)))
+                panic("trying to get new block from nonexistant device");
+            zone = inode->i_prealloc_zone++;
+            --inode->i_prealloc_count;
+            return zero_zone(sb, zone);
+        }
+        discard_prealloc(inode);    // it's written elsewhere now
+    }
+    //////////////////////////////////////////////////////////////////////////
+    if (!S_ISREG(inode->i_mode)) return new_block(inode->i_dev, goal);
+    if (!(sb = get_super(inode->i_dev)))
+        panic("trying to get new block from nonexistant device");
+    /***************************************************************/
+    struct bitmap zmap = ZMAP(sb);
+    int bit = goal_bit(sb, goal);
+    int len = PREALLOC_ZONES;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    if (next_bit(&zmap, bit, bit + 1, FIND_ZERO) == bit) {
+        // the goal is free: it, and the free zones right after it
+        int end = (bit + len < zmap.nr_bits) ? bit + len : zmap.nr_bits;
+        len = next_bit(&zmap, bit, end, FIND_ONE) - bit;
+    }
+    else if (!(bit = search_run(&zmap, bit, len))) {
+        // no room for a whole run: any zone
+        if (!(bit = search_run(&zmap, goal_bit(sb, goal), 1))) return 0;
+        len = 1;
+    }
+    /***************************************************************/
+    set_bits(&zmap, bit, len);
+    sb->s_free_zones -= len;
+    sb->s_zone_cursor = bit + len - 1;
+    zone = bit_zone(sb, bit);
+    inode->i_prealloc_zone = zone + 1;
+    inode->i_prealloc_count = len - 1;
+    return zero_zone(sb, zone);
+}
+
+/* the preallocated zones of inode go back to the free ones */
+void discard_prealloc(struct m_inode* inode)
+{
+    while (inode->i_prealloc_count) {
+        --inode->i_prealloc_count;
+        free_block(inode->i_dev, inode->i_prealloc_zone++);
+    }
 }
 
 void free_block(int dev, int block)
@@ -174,6 +344,8 @@ void free_block(int dev, int block)
     }
     /***************************************************************/
     bh->b_dirt = 1;
+    sb->s_zmap_full &= ~(1 << ZMAP_INDX(block));
+    sb->s_free_zones++;
 }
 
 struct m_inode* new_inode(int dev)
@@ -184,45 +356,18 @@ struct m_inode* new_inode(int dev)
     struct super_block* sb = get_super(dev);
     if (!sb) panic("new_inode with unknown device");
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
-    struct buffer_head* bh;
-    int i, j;
-    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
-
-    for (i = 0; i < sb->s_imap_blocks; ++i) {
-        bh = sb->s_imap[i];
-#ifdef DEBUG
-        if (!bh) {
-            printkc("new_inode: Dev %#x: Filesystem is corrupted!\n", dev); 
-            panic("new_inode: Filesystem is corrupted!");
-        } 
-#endif
-        j = find_first_zero(bh->b_data);
-        if (j < BLCK_BITS) break;
-    }   // find the nr of the first emtpy inode
-    /***************************************************************/
-#ifdef DEBUG
-    if (j >= BLCK_BITS && i < sb->s_imap_blocks) {
-        printkc("new_inode: Something wrong with the bitmap searching!\n");
-        panic("new_inode: Something wrong with the bitmap searching!");
-    }
-#endif
-    /***************************************************************/
-    if (i == sb->s_imap_blocks) {
+    struct bitmap imap = IMAP(sb);
+    int j = search_run(&imap, sb->s_inode_cursor, 1);
+    if (!j) {
 #ifdef DEBUG
         printkc("new_inode: Dev %#x: run out of i-nodes!\n", dev);
 #endif
         iput(inode);
         return NULL;
     }
-    //////////////////////////////////////////////////////////////////////////
-    if (set_bit(j, bh->b_data)) panic("new_node: bit already set");
-    bh->b_dirt = 1;
-    /***************************************************************/
-    j += i * BLCK_BITS;
-    if (j > sb->s_ninodes) {
-        iput(inode);
-        return NULL;
-    }
+    set_bits(&imap, j, 1);
+    sb->s_inode_cursor = j;
+    sb->s_free_inodes--;
     /***************************************************************/
     //inode->i_count = 1;   // already set by get_empty_inode()
     inode->i_nlinks = 1;
@@ -232,6 +377,7 @@ struct m_inode* new_inode(int dev)
     inode->i_dirt = 1;
     inode->i_num = j;
     inode->i_mtime = inode->i_atime = inode->i_ctime = CURRENT_TIME;
+    insert_inode_hash(inode);
     /***************************************************************/
     return inode;
 }
@@ -244,7 +390,7 @@ void free_inode(struct m_inode* inode)
     if (inr < 1) panic("tring to free inode 0 or negative inodes");
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
 	if (!inode->i_dev) {
-		memset(inode, 0, sizeof(*inode));
+		clear_inode(inode);
 		return;
 	}
     /***************************************************************/
@@ -264,9 +410,12 @@ void free_inode(struct m_inode* inode)
     /***************************************************************/
 	if (clear_bit(inr & BLCK_MASK, bh->b_data))
 		printk("free_inode: bit already cleared.\n\r");
+    else
+        sb->s_free_inodes++;
+    sb->s_imap_full &= ~(1 << IMAP_INDX(inr));
     /***************************************************************/
 	bh->b_dirt = 1;
     /***************************************************************/
-	memset(inode, 0, sizeof(*inode));
+	clear_inode(inode);
 }
 
@@ -33,8 +33,8 @@ int block_write(int dev, long* pos, char* buf, int count)
         written += chars;
         count -= chars;
         /***************************************************************/
-        char* p = offset + bh->b_data;
-        while (chars-- > 0) *(p++) = get_fs_byte(buf++);
+        copy_block_fs2es(buf, offset + bh->b_data, chars);
+        buf += chars;
         bh->b_dirt = 1;
         brelse(bh);
         /***************************************************************/
@@ -62,8 +62,8 @@ int block_read(int dev, unsigned long* pos, char* buf, int count)
         read += chars;
         count -= chars;
         /***************************************************************/
-        char* p = offset + bh->b_data;
-        while (chars-- > 0) put_fs_byte(*(p++), buf++);
+        copy_block_ds2fs(offset + bh->b_data, buf, chars);
+        buf += chars;
         brelse(bh);
         /***************************************************************/
         offset = 0;
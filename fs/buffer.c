@@ -20,6 +20,8 @@
 
 #include <stdarg.h>
  
+#include <errno.h>
+
 #include <linux/config.h>
 #include <linux/sched.h>
 #include <linux/kernel.h>
@@ -32,11 +34,37 @@ extern void put_super(int);
 extern void invalidate_inodes(int);
 
 struct buffer_head* start_buffer = (struct buffer_head*) &end;
-struct buffer_head* hash_table[NR_HASH] = {};
-static struct buffer_head* free_list = NULL;
+/* 
+ * The hash table sits at 'end', right before the buffer heads. Its size is
+ * a power of two picked by buffer_init(), about one bucket per two buffers.
+ */
+static struct buffer_head** hash_table = NULL;
+int nr_hash = 0;
+static int hash_shift = 32;     /* 32 - log2(nr_hash) */
+/* lookup statistics, see show_buffer_stat() */
+static unsigned long hash_lookups = 0;
+static unsigned long hash_probes = 0;
 static struct task_struct* buffer_wait = NULL;
 int NR_BUFFERS = 0;
 
+/*
+ * Unused buffers (b_count == 0) are kept on two LRU lists, one for clean
+ * and one for dirty buffers, least recently released first. Buffers in use
+ * are on neither. getblk() takes its victim from the head of the clean
+ * list, and bdflush keeps writing out the dirty list so that the clean
+ * one doesn't run dry. Note that a buffer's b_dirt may change behind our
+ * back (add_request() clears it), so the lists are only a hint: the
+ * buffer itself has the last word.
+ */
+static struct buffer_head* lru_list[2] = {NULL, NULL}; /* BUF_CLEAN/DIRTY */
+static int nr_lru[2] = {0, 0};
+static struct task_struct* bdflush_wait = NULL;
+static bool bdflush_running = false;
+
+/* bdflush wakes up below LOW clean buffers, and goes back to sleep at HIGH */
+#define BDFLUSH_LOW (NR_BUFFERS >> 3)
+#define BDFLUSH_HIGH (NR_BUFFERS >> 2)
+
 static inline void wait_on_buffer(struct buffer_head* bh)
 {
 	cli();
@@ -78,36 +106,29 @@ static inline void invalidate_buffers(int dev)
     }
 }
 
-#define _hashfn(dev,block) (((unsigned)(dev^block))%NR_HASH)
+/*
+ * Multiplicative (Fibonacci) hashing: the top bits of the product depend on
+ * all the bits of the key, so consecutive blocks spread over the whole table
+ * and the same block nr on different devices doesn't collide.
+ */
+#define _hashfn(dev,block) \
+    ((((unsigned)(block) ^ ((unsigned)(dev) << 16)) * 0x9E3779B1U) \
+     >> hash_shift)
 #define hash(dev,block) hash_table[_hashfn(dev,block)]
 
-static inline void remove_from_queues(struct buffer_head* bh)
+static inline void remove_from_hash(struct buffer_head* bh)
 {
-    /* remove from hash-queue */
 	if (bh->b_next) bh->b_next->b_prev = bh->b_prev;
 	if (bh->b_prev) bh->b_prev->b_next = bh->b_next;
     /***************************************************************/
 	if (hash(bh->b_dev, bh->b_blocknr) == bh)
 		hash(bh->b_dev, bh->b_blocknr) = bh->b_next;
-    //////////////////////////////////////////////////////////////////////////
-    /* remove from free list */
-	if (!(bh->b_prev_free) || !(bh->b_next_free))
-		panic("Free block list corrupted");
-    /***************************************************************/
-	bh->b_prev_free->b_next_free = bh->b_next_free;
-	bh->b_next_free->b_prev_free = bh->b_prev_free;
-	if (free_list == bh) free_list = bh->b_next_free;
+	bh->b_prev = NULL;
+	bh->b_next = NULL;
 }
 
-static inline void insert_into_queues(struct buffer_head* bh)
+static inline void insert_into_hash(struct buffer_head* bh)
 {
-    /* put at end of free list */
-	bh->b_next_free = free_list;
-	bh->b_prev_free = free_list->b_prev_free;
-    /***************************************************************/
-	free_list->b_prev_free->b_next_free = bh;
-	free_list->b_prev_free = bh;
-    //////////////////////////////////////////////////////////////////////////
     /* put the buffer in new hash-queue if it has a device */
 	bh->b_prev = NULL;
 	bh->b_next = NULL;
@@ -115,13 +136,59 @@ static inline void insert_into_queues(struct buffer_head* bh)
     /***************************************************************/
 	bh->b_next = hash(bh->b_dev, bh->b_blocknr);
 	hash(bh->b_dev, bh->b_blocknr) = bh;
-	bh->b_next->b_prev = bh;
+	if (bh->b_next) bh->b_next->b_prev = bh;
+}
+
+static inline void remove_from_lru(struct buffer_head* bh)
+{
+    if (bh->b_list == BUF_USED) return;
+    /***************************************************************/
+	if (!(bh->b_prev_free) || !(bh->b_next_free))
+		panic("Free block list corrupted");
+    /***************************************************************/
+    struct buffer_head** head = lru_list + bh->b_list;
+    if (bh->b_next_free == bh)
+        *head = NULL;
+    else {
+        bh->b_prev_free->b_next_free = bh->b_next_free;
+        bh->b_next_free->b_prev_free = bh->b_prev_free;
+        if (*head == bh) *head = bh->b_next_free;
+    }
+    bh->b_prev_free = bh->b_next_free = NULL;
+    --nr_lru[bh->b_list];
+    bh->b_list = BUF_USED;
+}
+
+/* put at the end (most recently used) of the clean or dirty list */
+static inline void insert_into_lru(struct buffer_head* bh)
+{
+    bh->b_list = bh->b_dirt ? BUF_DIRTY : BUF_CLEAN;
+    struct buffer_head** head = lru_list + bh->b_list;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    if (*head) {
+        bh->b_next_free = *head;
+        bh->b_prev_free = (*head)->b_prev_free;
+        (*head)->b_prev_free->b_next_free = bh;
+        (*head)->b_prev_free = bh;
+    }
+    else
+        *head = bh->b_next_free = bh->b_prev_free = bh;
+    ++nr_lru[bh->b_list];
+}
+
+// drop a reference without waiting on the buffer
+static inline void put_buffer(struct buffer_head* bh)
+{
+	if (!(bh->b_count--)) panic("Trying to free free buffer");
+    if (!bh->b_count) insert_into_lru(bh);
 }
 
 static inline struct buffer_head* find_buffer(int dev, int block)
 {		
     struct buffer_head* tmp = hash(dev, block);
+    ++hash_lookups;
     while (tmp) {
+        ++hash_probes;
         if (tmp->b_dev == dev && tmp->b_blocknr == block) return tmp;
         /*******************************************************/
         tmp = tmp->b_next;
@@ -139,15 +206,39 @@ static inline struct buffer_head* find_buffer(int dev, int block)
              "D" (to) \
             )
 
+#define ZEROBLK(to) \
+    __asm__ ("cld\n\t" \
+             "rep stosl\n\t" \
+             : \
+             : \
+             "a" (0), \
+             "c" (BLOCK_SIZE/4), \
+             "D" (to) \
+            )
+
 /*
  **************************** INTERFACE **************************************
  */
 
 void buffer_init(laddr_t buffer_end)
 {
-    struct buffer_head* h = start_buffer;
     void* b =(void*) ((buffer_end == 1<<20) ? (640*1024) : buffer_end);
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    /* Step 1. size the hash table from the nr of buffers we'll get */
+    laddr_t room = (laddr_t) b - (laddr_t) &end;
+    if ((laddr_t) b > 0x100000) room -= 0x100000 - 0xA0000;  // the hole
+    int nr = room / (BLOCK_SIZE + sizeof(struct buffer_head));
+    /***************************************************************/
+    for (nr_hash = 16, hash_shift = 28; 
+         nr_hash < (nr >> 1) && nr_hash < MAX_HASH; 
+         nr_hash <<= 1, --hash_shift)
+        /* nothing */;
+    hash_table = (struct buffer_head**) &end;
+    for (int i = 0; i < nr_hash; ++i) hash_table[i] = NULL;
+    start_buffer = (struct buffer_head*) (hash_table + nr_hash);
+    //////////////////////////////////////////////////////////////////////////
+    /* Step 2. buffer heads grow up from there, data blocks down from b */
+    struct buffer_head* h = start_buffer;
     while ((b -= BLOCK_SIZE) >= ((void*) (h+1))) {
         h->b_dev = 0;
         h->b_dirt = 0;
@@ -157,9 +248,11 @@ void buffer_init(laddr_t buffer_end)
         h->b_wait = NULL;
         h->b_next = NULL;
         h->b_prev = NULL;
+        h->b_reqnext = NULL;
         h->b_data = (char*) b;
         h->b_prev_free = h-1;
         h->b_next_free = h+1;
+        h->b_list = BUF_CLEAN;
         ++h;
         ++NR_BUFFERS;
         /********************************************************/
@@ -168,22 +261,40 @@ void buffer_init(laddr_t buffer_end)
     }
     /***************************************************************/
     --h;
-    free_list = start_buffer;
-    free_list->b_prev_free = h;
-    h->b_next_free = free_list;
-    //////////////////////////////////////////////////////////////////////////
-    /*
-     * for (register int i = 0;i < NR_HASH; ++i) hash_table[i]=NULL;
-     */
-#ifdef DEBUG
-    for (int i = 0;i < NR_HASH; ++i) 
-        if (hash_table[i]) { 
-            printkc("buffer_init: hash_table is not initialized properly!\n");
-            panic("buffer_init: hash_table is not initialized properly!");
-        }
-#endif
+    lru_list[BUF_CLEAN] = start_buffer;
+    start_buffer->b_prev_free = h;
+    h->b_next_free = start_buffer;
+    nr_lru[BUF_CLEAN] = NR_BUFFERS;
 }	
 
+/*
+ * Print hash-chain statistics: how long the chains are right now, and how
+ * many buffers find_buffer() had to look at per lookup so far. Called
+ * along with show_stat() from the keyboard.
+ */
+void show_buffer_stat(void)
+{
+    int used = 0, max = 0, total = 0;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    for (int i = 0; i < nr_hash; ++i) {
+        int len = 0;
+        for (struct buffer_head* bh = hash_table[i]; bh; bh = bh->b_next)
+            ++len;
+        if (len) ++used;
+        if (len > max) max = len;
+        total += len;
+    }
+    /***************************************************************/
+    printk("buffer hash: %d buckets, %d used, %d hashed, longest chain %d\n\r",
+           nr_hash, used, total, max);
+    printk("buffer hash: %d lookups, %d.%02d probes per lookup\n\r",
+           hash_lookups, 
+           hash_lookups ? hash_probes / hash_lookups : 0,
+           hash_lookups ? hash_probes * 100 / hash_lookups % 100 : 0);
+    printk("buffer lru: %d clean, %d dirty\n\r", 
+           nr_lru[BUF_CLEAN], nr_lru[BUF_DIRTY]);
+}
+
 /*
  * Why like this, I hear you say... The reason is race-conditions.
  * As we don't lock buffers (unless we are readint them, that is),
@@ -197,10 +308,11 @@ struct buffer_head* get_hash_table(int dev, int block)
         struct buffer_head* bh = find_buffer(dev, block);
         if (!bh) return NULL;
      
-        bh->b_count++;  // make sure it won't be freed
+        // make sure it won't be freed
+        if (!bh->b_count++) remove_from_lru(bh);
         wait_on_buffer(bh);
         if (bh->b_dev == dev && bh->b_blocknr == block) return bh;
-        bh->b_count--;  // make sure it can be freed again
+        put_buffer(bh);  // make sure it can be freed again
     }
 }
 
@@ -209,27 +321,20 @@ struct buffer_head* get_hash_table(int dev, int block)
  * race-conditions. Most of the code is seldom used, (ie repeating),
  * so it should be much more efficient than it looks.
  *
- * The algoritm is changed: hopefully better, and an elusive bug removed.
+ * The victim is the least recently used clean buffer, so there's no
+ * searching. Only when there is no clean buffer at all do we fall back
+ * to writing out a dirty one ourselves.
  */
 struct buffer_head* getblk(int dev, int block)
 {
-#define BADNESS(bh) (((bh)->b_dirt<<1)+(bh)->b_lock)
-
 repeat:
-    struct buffer_head* tmp = free_list;
     struct buffer_head* bh = get_hash_table(dev,block);
     if (bh) return bh;
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
-    do {
-        if (tmp->b_count) continue;
-        /*******************************************************/
-        if (!bh || BADNESS(tmp) < BADNESS(bh)) {
-            bh = tmp;
-            if (!BADNESS(tmp)) break;
-        } /* and repeat until we find something good */
-    } while ((tmp = tmp->b_next_free) != free_list);
+    if (nr_lru[BUF_CLEAN] < BDFLUSH_LOW && nr_lru[BUF_DIRTY])
+        wake_up(&bdflush_wait);
     /***************************************************************/
-    if (!bh) {
+    if (!(bh = lru_list[BUF_CLEAN]) && !(bh = lru_list[BUF_DIRTY])) {
         sleep_on(&buffer_wait);
         goto repeat;
     }
@@ -248,14 +353,15 @@ repeat:
     if (find_buffer(dev, block)) goto repeat;
     /* OK, FINALLY we know that this buffer is the only one of it's kind, */
     /* and that it's unused (b_count=0), unlocked (b_lock=0), and clean */
+    remove_from_lru(bh);
+    remove_from_hash(bh);
     bh->b_count = 1;
     bh->b_dirt = 0;
     bh->b_uptodate = 0;
-    remove_from_queues(bh);
     /***************************************************************/
     bh->b_dev = dev;
     bh->b_blocknr = block;
-    insert_into_queues(bh);
+    insert_into_hash(bh);
     /***************************************************************/
     return bh;
 }
@@ -265,7 +371,7 @@ void brelse(struct buffer_head* buf)
 	if (!buf) return;
 
 	wait_on_buffer(buf);
-	if (!(buf->b_count--)) panic("Trying to free free buffer");
+	put_buffer(buf);
 	wake_up(&buffer_wait);
 }
 
@@ -314,13 +420,7 @@ struct buffer_head* breada(int dev, int first, ...)
     if (!bh) panic("bread: getblk returned NULL\n");
     if (!bh->b_uptodate) ll_rw_block(READ, bh);
 
-    while ((first = va_arg(args, int)) >= 0) {
-        struct buffer_head* tmp = getblk(dev, first);
-        if (tmp) {
-            if (!tmp->b_uptodate) ll_rw_block(READA, tmp);
-            tmp->b_count--;     // reada: read ahead but not referenced
-        }
-    }
+    while ((first = va_arg(args, int)) >= 0) bread_ahead(dev, first);
     va_end(args);
     //////////////////////////////////////////////////////////////////////////
     wait_on_buffer(bh);
@@ -330,17 +430,34 @@ struct buffer_head* breada(int dev, int first, ...)
     return NULL;
 }
 
+/*
+ * bread_ahead starts reading a block into the cache, if it isn't there
+ * yet, and returns without waiting for it. Nothing is kept referenced.
+ */
+void bread_ahead(int dev, int block)
+{
+    struct buffer_head* bh = getblk(dev, block);
+    if (!bh) return;
+    /***************************************************************/
+    if (!bh->b_uptodate) ll_rw_block(READA, bh);
+    put_buffer(bh);     // reada: read ahead but not referenced
+}
+
 /*
  * bread_page reads four buffers into memory at the desired address. It's
  * a function of its own, as there is some speed to be got by reading them
  * all at the same time, not waiting for one to be read, and then another
  * etc.
+ *
+ * Holes (b[i] == 0) and blocks that fail to read are zero-filled, so the
+ * whole page is always defined, whatever the caller handed us.
  */
 void bread_page(laddr_t address, int dev, int b[4])
 {
     struct buffer_head* bh[4];
     int i;
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    /* Step 1. queue all the reads before sleeping on any of them */
     for (i = 0; i < 4; ++i)
         if (b[i]) {
             bh[i] = getblk(dev, b[i]);
@@ -349,13 +466,37 @@ void bread_page(laddr_t address, int dev, int b[4])
         else
             bh[i] = NULL;
     //////////////////////////////////////////////////////////////////////////
-    for (i = 0; i < 4; ++i, address += BLOCK_SIZE)
-        if (bh[i]) {
-            wait_on_buffer(bh[i]);
-            if (bh[i]->b_uptodate)
-                COPYBLK((laddr_t) bh[i]->b_data, address);
-            brelse(bh[i]);
+    /* Step 2. the elevator may complete them in any order: collect them */
+    for (i = 0; i < 4; ++i, address += BLOCK_SIZE) {
+        if (!bh[i]) {
+            ZEROBLK(address);
+            continue;
         }
+        /***************************************************************/
+        wait_on_buffer(bh[i]);
+        if (bh[i]->b_uptodate)
+            COPYBLK((laddr_t) bh[i]->b_data, address);
+        else
+            ZEROBLK(address);
+        brelse(bh[i]);
+    }
+}
+
+/*
+ * bwrite_page copies a page into the four buffers and leaves them dirty
+ * for bdflush: the page can be reused as soon as we return. Blocks given
+ * as 0 are skipped.
+ */
+void bwrite_page(laddr_t address, int dev, int b[4])
+{
+    for (int i = 0; i < 4; ++i, address += BLOCK_SIZE) {
+        if (!b[i]) continue;
+        struct buffer_head* bh = getblk(dev, b[i]);
+        COPYBLK(address, (laddr_t) bh->b_data);
+        bh->b_uptodate = 1;
+        bh->b_dirt = 1;
+        brelse(bh);
+    }
 }
 
 // no check device validity! Be careful
@@ -371,6 +512,7 @@ int sync_dev(int dev)
 // system call: sync
 int sys_sync(void)
 {
+	sync_mmaps();		/* shared file mappings into buffers */
 	sync_inodes();		/* write out inodes into buffers */
     //////////////////////////////////////////////////////////////////////////
 	struct buffer_head* bh = start_buffer;
@@ -382,6 +524,47 @@ int sys_sync(void)
 	return 0;
 }
 
+/*
+ * bdflush never returns: the calling process becomes the buffer flusher.
+ * It sleeps until getblk() notices that the clean list is running low,
+ * then writes out dirty buffers (oldest first) until there are enough
+ * clean ones again. init starts it at boot.
+ */
+int sys_bdflush(void)
+{
+    if (!suser()) return -EPERM;
+    if (bdflush_running) return -EBUSY;
+    bdflush_running = true;
+    //////////////////////////////////////////////////////////////////////////
+    for (;;) {
+        int cleaned = 0;
+        /* at most one pass over the list: some may not be writable */
+        for (int n = nr_lru[BUF_DIRTY]; 
+             n > 0 && nr_lru[BUF_CLEAN] < BDFLUSH_HIGH; 
+             --n) 
+        {
+            struct buffer_head* bh = lru_list[BUF_DIRTY];
+            if (!bh) break;
+            /*******************************************************/
+            bh->b_count++;      // hold it while we may sleep
+            remove_from_lru(bh);
+            if (bh->b_dirt) ll_rw_block(WRITE, bh);
+            if (!bh->b_dirt) ++cleaned;
+            put_buffer(bh);     // clean now: goes to the clean list
+        }
+        /***************************************************************/
+        /* 
+         * Go on only if this pass got somewhere: buffers of a device with
+         * no driver stay dirty, and we would spin in kernel mode for ever.
+         */
+        if (cleaned && nr_lru[BUF_CLEAN] < BDFLUSH_LOW && nr_lru[BUF_DIRTY]) 
+            continue;
+        sleep_on(&bdflush_wait);
+    }
+    //////////////////////////////////////////////////////////////////////////
+    return 0;
+}
+
 /*
  * This routine checks whether a floppy has been changed, and
  * invalidates all buffer-cache-entries in that case. This
@@ -407,5 +590,6 @@ void check_disk_change(int dev)
     //////////////////////////////////////////////////////////////////////////
     invalidate_inodes(dev);
     invalidate_buffers(dev);
+    invalidate_cached_pages(dev, 0);
 }
 
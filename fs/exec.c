@@ -172,7 +172,7 @@ static unsigned long change_ldt(unsigned long text_size, unsigned long* page)
     //unsigned long code_base = get_base(current->ldt[1]);
     unsigned long code_limit = (text_size + PAGE_SIZE -1) & 0xFFFFF000;
     unsigned long data_base = get_base(current->ldt[1]); // the same as code
-    unsigned long data_limit = 0x4000000;     // 64 MB
+    unsigned long data_limit = TASK_SIZE;     // the whole window
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
     //set_base(current->ldt[1], code_base);
     set_limit(current->ldt[1], code_limit);
@@ -186,7 +186,7 @@ static unsigned long change_ldt(unsigned long text_size, unsigned long* page)
     data_base += data_limit;
     for (int i = MAX_ARG_PAGES-1; i >= 0; --i) {
         data_base -= PAGE_SIZE;
-        if (page[i]) put_page(page[i], data_base);
+        if (page[i] && put_page(page[i], data_base)) ++current->rss;
     }
     /***************************************************************/
     return data_limit;
@@ -347,6 +347,10 @@ restart_interp:
         retval = -ENOEXEC;
         goto exec_error2;
     }
+    if (ex.a_data + ex.a_bss > current->rlim[RLIMIT_DATA].rlim_cur) {
+        retval = -ENOMEM;
+        goto exec_error2;
+    }
     /***************************************************************/
     if (N_TXTOFF(ex) != BLOCK_SIZE) {
         printk("%s: N_TXTOFF != BLOCK_SIZE. See a.out.h.", filename);
@@ -375,6 +379,7 @@ restart_interp:
         if ((current->close_on_exec >> i) & 1) sys_close(i);
     current->close_on_exec = 0;
     /***************************************************************/
+    exit_mmap();
     free_page_tables(get_base(current->ldt[1]), get_limit(0x0f));
     free_page_tables(get_base(current->ldt[2]), get_limit(0x17));
     /***************************************************************/
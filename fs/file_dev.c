@@ -14,6 +14,47 @@
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
+/* read-ahead window, in blocks: it starts small and doubles up to max */
+#define RA_MIN_WIN 4
+#define RA_MAX_WIN 32
+
+/*
+ * Called for every block file_read() is about to read. A reader that
+ * keeps asking for the same block or the one after it is sequential: the
+ * first time, we read RA_MIN_WIN blocks ahead; every time it has eaten
+ * through half of what we read ahead, we double the window and queue
+ * more. Anything else switches read-ahead off until it's sequential
+ * again. The blocks are only queued (READA), nobody waits for them here.
+ */
+static void file_readahead(struct m_inode* inode, struct file* filp,
+                           unsigned long block)
+{
+    // small reads may well ask for the same block again
+    bool sequential = (block == filp->f_ra_next || 
+                       block + 1 == filp->f_ra_next);
+    filp->f_ra_next = block + 1;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    if (!sequential) {
+        filp->f_ra_win = 0;
+        filp->f_ra_end = block + 1;
+        return;
+    }
+    /***************************************************************/
+    if (filp->f_ra_end < block + 1) filp->f_ra_end = block + 1;
+    if (filp->f_ra_win && block + (filp->f_ra_win >> 1) < filp->f_ra_end)
+        return;     // still well inside the current window
+    //////////////////////////////////////////////////////////////////////////
+    filp->f_ra_win = filp->f_ra_win ? MIN(filp->f_ra_win << 1, RA_MAX_WIN)
+                                    : RA_MIN_WIN;
+    unsigned long last = (inode->i_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    last = MIN(last, block + 1 + filp->f_ra_win);
+    /***************************************************************/
+    for (; filp->f_ra_end < last; ++filp->f_ra_end) {
+        int nr = bmap(inode, filp->f_ra_end);
+        if (nr) bread_ahead(inode->i_dev, nr);  // holes need no reading
+    }
+}
+
 int file_read(struct m_inode* inode, struct file* filp, char* buf, int count)
 {
     int left = count;
@@ -21,6 +62,7 @@ int file_read(struct m_inode* inode, struct file* filp, char* buf, int count)
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
     while (left) {
         struct buffer_head* bh;
+        file_readahead(inode, filp, (filp->f_pos)/BLOCK_SIZE);
         int nr = bmap(inode, (filp->f_pos)/BLOCK_SIZE);
         //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
         if (nr) {
@@ -38,8 +80,8 @@ int file_read(struct m_inode* inode, struct file* filp, char* buf, int count)
         left -= chars;
         /***************************************************************/
         if (bh) {
-            char* p = nr + bh->b_data;
-            while (chars-- > 0) put_fs_byte(*(p++), buf++);
+            copy_block_ds2fs(nr + bh->b_data, buf, chars);
+            buf += chars;
             brelse(bh);
         } 
         else
@@ -58,6 +100,7 @@ int file_write(struct m_inode* inode, struct file* filp, char* buf, int count)
      */
     off_t pos = (filp->f_flags & O_APPEND) ? inode->i_size : filp->f_pos;
     int i = 0;
+    invalidate_cached_pages(inode->i_dev, inode->i_num);    // if it's a binary
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
     while (i < count) {
         int block = create_block(inode, pos/BLOCK_SIZE);
@@ -81,7 +124,9 @@ int file_write(struct m_inode* inode, struct file* filp, char* buf, int count)
         }
         /***************************************************************/
         i += c;
-        while (c-->0) *(p++) = get_fs_byte(buf++);
+        copy_block_fs2es(buf, p, c);
+        update_cached_page(inode->i_dev, inode->i_num, pos - c, p, c);
+        buf += c;
         /***************************************************************/
         bh->b_dirt = 1;
         brelse(bh);
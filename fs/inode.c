@@ -12,9 +12,91 @@
 #include <asm/system.h>
 
 extern struct super_block super_block[NR_SUPER];
-struct m_inode inode_table[NR_INODE] = {};
+struct m_inode* inode_table = NULL;
+int nr_inodes = 0;
 static struct task_struct* empty_inode_wait = NULL;
 
+/*
+ * In-core inodes are hashed by (dev, nr), so iget() looks at a few of
+ * them instead of all. Every inode is on one of two circular lists: the
+ * unused ones (i_count == 0) in lru order, least recently used first, for
+ * get_empty_inode() to take from the head, and the used ones. Only used
+ * inodes can be dirty, as iput() writes an inode back before it lets go
+ * of the last reference: sync_inodes() needn't look at the others.
+ */
+#define INODE_FREE 0
+#define INODE_USED 1
+
+static struct m_inode** inode_hash = NULL;
+static int nr_ihash = 0;
+static int ihash_shift = 32;    /* 32 - log2(nr_ihash) */
+static struct m_inode* inode_list[2] = {NULL, NULL};
+
+/* the same Fibonacci hashing as for the buffers */
+#define _ihashfn(dev,nr) \
+    ((((unsigned)(nr) ^ ((unsigned)(dev) << 16)) * 0x9E3779B1U) \
+     >> ihash_shift)
+#define ihash(dev,nr) inode_hash[_ihashfn(dev,nr)]
+
+static inline void remove_from_hash(struct m_inode* inode)
+{
+    if (inode->i_next) inode->i_next->i_prev = inode->i_prev;
+    if (inode->i_prev) inode->i_prev->i_next = inode->i_next;
+    /***************************************************************/
+    if (ihash(inode->i_dev, inode->i_num) == inode)
+        ihash(inode->i_dev, inode->i_num) = inode->i_next;
+    inode->i_prev = NULL;
+    inode->i_next = NULL;
+}
+
+static inline struct m_inode* find_inode(int dev, int nr)
+{
+    for (struct m_inode* inode = ihash(dev, nr); inode; inode = inode->i_next)
+        if (inode->i_dev == dev && inode->i_num == nr) return inode;
+    return NULL;
+}
+
+static inline void remove_from_list(int list, struct m_inode* inode)
+{
+    struct m_inode** head = inode_list + list;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    if (inode->i_next_free == inode)
+        *head = NULL;
+    else {
+        inode->i_prev_free->i_next_free = inode->i_next_free;
+        inode->i_next_free->i_prev_free = inode->i_prev_free;
+        if (*head == inode) *head = inode->i_next_free;
+    }
+    inode->i_prev_free = inode->i_next_free = NULL;
+}
+
+/* put at the end (most recently used) of the list */
+static inline void insert_into_list(int list, struct m_inode* inode)
+{
+    struct m_inode** head = inode_list + list;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    if (*head) {
+        inode->i_next_free = *head;
+        inode->i_prev_free = (*head)->i_prev_free;
+        (*head)->i_prev_free->i_next_free = inode;
+        (*head)->i_prev_free = inode;
+    }
+    else
+        *head = inode->i_next_free = inode->i_prev_free = inode;
+}
+
+/* 
+ * The last reference is gone. An inode of no device has nothing worth
+ * keeping: it goes first in line for reuse.
+ */
+static void put_unused(struct m_inode* inode)
+{
+    remove_from_list(INODE_USED, inode);
+    insert_into_list(INODE_FREE, inode);
+    if (!inode->i_dev) inode_list[INODE_FREE] = inode;
+    wake_up(&empty_inode_wait);
+}
+
 static inline void wait_on_inode(struct m_inode* inode)
 {
     cli();
@@ -105,7 +187,8 @@ static int _bmap(struct m_inode* inode, int block, int create)
     //////////////////////////////////////////////////////////////////////////
     if (block < 7) {
         if (create && !inode->i_zone[block]) {
-            if ((inode->i_zone[block] = new_block(inode->i_dev))) {
+            int goal = block ? inode->i_zone[block - 1] + 1 : 0;
+            if ((inode->i_zone[block] = new_file_block(inode, goal))) {
                 inode->i_ctime = CURRENT_TIME;
                 inode->i_dirt = 1;
             }
@@ -120,7 +203,8 @@ static int _bmap(struct m_inode* inode, int block, int create)
     block -= 7;
     if (block < 512) {
         if (create && !inode->i_zone[7]) {   // Indirect
-            if ((inode->i_zone[7] = new_block(inode->i_dev))) {
+            int goal = inode->i_zone[6] + 1;
+            if ((inode->i_zone[7] = new_file_block(inode, goal))) {
                 inode->i_ctime = CURRENT_TIME;
                 inode->i_dirt = 1;
             }
@@ -133,7 +217,9 @@ static int _bmap(struct m_inode* inode, int block, int create)
         /***************************************************************/
         i = ((unsigned short*) (bh->b_data))[block];
         if (create && !i) {
-            if ((i = new_block(inode->i_dev))) {
+            int goal = (block ? ((unsigned short*) (bh->b_data))[block - 1]
+                              : inode->i_zone[7]) + 1;
+            if ((i = new_file_block(inode, goal))) {
                 ((unsigned short*) (bh->b_data))[block] = i;
                 bh->b_dirt = 1;
             }
@@ -145,7 +231,7 @@ static int _bmap(struct m_inode* inode, int block, int create)
     //////////////////////////////////////////////////////////////////////////
     block -= 512;
     if (create && !inode->i_zone[8]) {    // Double indirect
-        if ((inode->i_zone[8] = new_block(inode->i_dev))) {
+        if ((inode->i_zone[8] = new_file_block(inode, 0))) {
             inode->i_dirt=1;
             inode->i_ctime=CURRENT_TIME;
         }
@@ -158,7 +244,7 @@ static int _bmap(struct m_inode* inode, int block, int create)
     i = ((unsigned short*) (bh->b_data))[block >> 9];
     /***************************************************************/
     if (create && !i) {
-        if ((i = new_block(inode->i_dev))) {
+        if ((i = new_file_block(inode, 0))) {
             ((unsigned short*) (bh->b_data))[block >> 9] = i;
             bh->b_dirt = 1;
         }
@@ -169,10 +255,14 @@ static int _bmap(struct m_inode* inode, int block, int create)
     //////////////////////////////////////////////////////////////////////////
     bh = bread(inode->i_dev, i);
     if (!bh) return 0;
+    int ind = i;
     i = ((unsigned short*) bh->b_data)[block & 511];
     /***************************************************************/
     if (create && !i) {
-        if ((i = new_block(inode->i_dev))) {
+        int goal = ((block & 511) ? 
+                    ((unsigned short*) (bh->b_data))[(block & 511) - 1] : 
+                    ind) + 1;
+        if ((i = new_file_block(inode, goal))) {
             ((unsigned short*) (bh->b_data))[block & 511] = i;
             bh->b_dirt = 1;
         }
@@ -186,24 +276,55 @@ static int _bmap(struct m_inode* inode, int block, int create)
  **************************** INTERFACE **************************************
  */
 
+/*
+ * Sets up the inode table and its hash table at mem_start: an in-core
+ * inode for every 32kB of memory, 64 at least. Returns the memory used.
+ */
+long inode_init(long mem_start, long mem_end)
+{
+    nr_inodes = mem_end >> 15;
+    if (nr_inodes < 64) nr_inodes = 64;
+    if (nr_inodes > 4096) nr_inodes = 4096;
+    for (nr_ihash = 16, ihash_shift = 28; nr_ihash < (nr_inodes >> 1);
+         nr_ihash <<= 1, --ihash_shift)
+        /* nothing */;
+    //////////////////////////////////////////////////////////////////////////
+    inode_hash = (struct m_inode**) mem_start;
+    inode_table = (struct m_inode*) (inode_hash + nr_ihash);
+    memset(inode_hash, 0, nr_ihash * sizeof(*inode_hash));
+    memset(inode_table, 0, NR_INODE * sizeof(*inode_table));
+    for (int i = 0; i < NR_INODE; ++i)
+        insert_into_list(INODE_FREE, inode_table + i);
+    //////////////////////////////////////////////////////////////////////////
+    return PAGE_ALIGN((long) (inode_table + NR_INODE)) - mem_start;
+}
+
+/* new_inode(): the inode has got its dev and nr */
+void insert_inode_hash(struct m_inode* inode)
+{
+    inode->i_next = ihash(inode->i_dev, inode->i_num);
+    ihash(inode->i_dev, inode->i_num) = inode;
+    if (inode->i_next) inode->i_next->i_prev = inode;
+}
+
+/* zeroes the inode, but it stays on its list */
+void clear_inode(struct m_inode* inode)
+{
+    struct m_inode* prev = inode->i_prev_free;
+    struct m_inode* next = inode->i_next_free;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    if (inode->i_dev) remove_from_hash(inode);
+    memset(inode, 0, sizeof(*inode));
+    inode->i_prev_free = prev;
+    inode->i_next_free = next;
+}
+
 struct m_inode* get_empty_inode(void)
 {
-    static struct m_inode* last_inode = inode_table;
     struct m_inode* inode;
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
     for ( ; ; ) {
-        inode = NULL;
-        //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
-        for (int i = 0; i < NR_INODE; ++i) {
-            if (++last_inode >= inode_table + NR_INODE)
-                last_inode = inode_table;   // circular
-            /***************************************************************/
-            if (!last_inode->i_count) {
-                inode = last_inode;
-                if (!inode->i_dirt && !inode->i_lock) break;
-            }
-        }
-        /***************************************************************/
+        inode = inode_list[INODE_FREE];     // the least recently used
         if (!inode) {
 #ifdef DEBUG
             printkc("get_empty_inode: i-node in mem has run out!\n");
@@ -211,6 +332,7 @@ struct m_inode* get_empty_inode(void)
             sleep_on(&empty_inode_wait);
             continue;
         }
+        if (!inode->i_dirt && !inode->i_lock) break;
         /***************************************************************/
         wait_on_inode(inode);
         while (inode->i_dirt) {
@@ -221,8 +343,10 @@ struct m_inode* get_empty_inode(void)
         if (!inode->i_count) break;
     } 
     //////////////////////////////////////////////////////////////////////////
-    memset(inode, 0, sizeof(*inode));
+    remove_from_list(INODE_FREE, inode);
+    clear_inode(inode);
     inode->i_count = 1;     // mark it as used ahead
+    insert_into_list(INODE_USED, inode);
     //////////////////////////////////////////////////////////////////////////
     return inode;
 }
@@ -238,6 +362,7 @@ struct m_inode* get_pipe_inode(void)
         printkc("get_pipe_inode: Failed to get a free page!\n");
 #endif
         inode->i_count = 0;
+        put_unused(inode);
         return NULL;
     }
     //////////////////////////////////////////////////////////////////////////
@@ -263,13 +388,12 @@ void iput(struct m_inode* inode)
         inode->i_dirt = 0;
         inode->i_pipe = 0;
         inode->i_count = 0;
-        wake_up(&empty_inode_wait);
+        put_unused(inode);
         return;
     }
     //////////////////////////////////////////////////////////////////////////
     if (!inode->i_dev) {    // the device is not valid anymore
-        inode->i_count--;
-        wake_up(&empty_inode_wait);
+        if (!--inode->i_count) put_unused(inode);
         return;
     }
     //////////////////////////////////////////////////////////////////////////
@@ -284,11 +408,16 @@ repeat:
         return;
     }
     //////////////////////////////////////////////////////////////////////////
+    if (inode->i_prealloc_count) {
+        discard_prealloc(inode);    /* we can sleep - so do again */
+        goto repeat;
+    }
+    //////////////////////////////////////////////////////////////////////////
     if (!inode->i_nlinks) {
         // it is safe to do truncate, since it is an orphan in the filesystem
         truncate(inode);        // TO_READ
         free_inode(inode);
-        wake_up(&empty_inode_wait);
+        put_unused(inode);
         return;
     }
     //////////////////////////////////////////////////////////////////////////
@@ -299,7 +428,7 @@ repeat:
     }
     //////////////////////////////////////////////////////////////////////////
     inode->i_count--;
-    wake_up(&empty_inode_wait);
+    put_unused(inode);
     return;
 }
 
@@ -307,24 +436,22 @@ repeat:
 struct m_inode* iget(int dev, int nr)
 {
     if (!dev) panic("iget with dev==0");
+    struct m_inode* empty = NULL;
 repeat:
-    struct m_inode* inode = inode_table;
+    struct m_inode* inode = find_inode(dev, nr);
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
-    while (inode < NR_INODE + inode_table) {
-        if (inode->i_dev != dev || inode->i_num != nr) {
-            ++inode;
-            continue;
-        }
-        /***************************************************************/
+    if (inode) {
         wait_on_inode(inode);
         if (inode->i_dev != dev || inode->i_num != nr) {
 #ifdef DEBUG
             printkc("iget(): the inode changed during sleep!\n");
 #endif
-            inode = inode_table;
-            continue;
+            goto repeat;
+        }
+        if (!inode->i_count++) {
+            remove_from_list(INODE_FREE, inode);
+            insert_into_list(INODE_USED, inode);
         }
-        inode->i_count++;
         ///////////////////////////////////////////////////////////////////////
         // Finally we have inode->idev == dev && inode->inum == nr
         if (inode->i_mount) {
@@ -334,6 +461,7 @@ repeat:
                 if (i == NR_SUPER) {
                     printk("iget(): Mounted inode hasn't got sb!\n");
                     inode->i_mount = 0;
+                    iput(empty);
                     return inode;
                 }
                 /*****************************************************/
@@ -342,15 +470,17 @@ repeat:
             /***********************************************************/
             dev = super_block[i].s_dev;
             nr = ROOT_INO;
-            inode = inode_table;
-            continue;
+            goto repeat;
         }
         /***************************************************************/
+        iput(empty);
         return inode;
     }
     //////////////////////////////////////////////////////////////////////////
-    struct m_inode* empty = get_empty_inode();
-    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    if (!empty) {
+        empty = get_empty_inode();
+        goto repeat;    // we may have slept: somebody may have read it
+    }
 #ifdef DEBUG
     if(!empty) {
         printkc("iget: get_empty_inode() mustn't be NULL!\n");
@@ -360,19 +490,26 @@ repeat:
     inode = empty;
     inode->i_dev = dev;
     inode->i_num = nr;
+    insert_inode_hash(inode);
     read_inode(inode);
     //////////////////////////////////////////////////////////////////////////
     return inode;
 }
 
+// only the used inodes can be dirty
 void sync_inodes(void)
 {
-    struct m_inode* inode = inode_table;
-    for(int i = 0; i < NR_INODE; ++i, ++inode) {
-        wait_on_inode(inode);
-        if (inode->i_dirt && !inode->i_pipe)
-            write_inode(inode);
-    }
+repeat:
+    struct m_inode* inode = inode_list[INODE_USED];
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    if (!inode) return;
+    do {
+        if (inode->i_dirt && inode->i_dev && !inode->i_pipe) {
+            write_inode(inode);     /* we can sleep - so look again */
+            goto repeat;
+        }
+        inode = inode->i_next_free;
+    } while (inode != inode_list[INODE_USED]);
 }
 
 void invalidate_inodes(int dev)
@@ -383,6 +520,7 @@ void invalidate_inodes(int dev)
         if (inode->i_dev == dev) {
             if (inode->i_count) printk("inode in use on removed disk\n");
             /***************************************************************/
+            remove_from_hash(inode);
             inode->i_dev = inode->i_dirt = 0;
         }
     }
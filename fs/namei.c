@@ -82,6 +82,159 @@ static int match(int len, const char* name, struct dir_entry* de)
     return same;
 }
 
+/*
+ * The dentry cache: what a name in a directory was found to be, so that
+ * path walks don't scan the same directories again. An entry is keyed by
+ * (dev, directory inode nr, name) and holds the inode nr, or 0 if the name
+ * was looked for and isn't there: a negative entry, so that a search path
+ * that misses is as cheap as one that hits.
+ *
+ * Entries go when the directory changes under them: add_entry() (so
+ * link(), mknod(), mkdir() and open() with O_CREAT), unlink() and rmdir().
+ * rmdir() also drops the entries under the directory it removes, as its
+ * inode nr will be reused, and put_super() those of the device. A lookup
+ * that slept in find_entry() doesn't fill the cache if a directory
+ * changed meanwhile (dcache_seq), cached or not: it may have read a block
+ * before the change.
+ *
+ * '..' of a pseudo-root or of a root inode isn't cached: find_entry() has
+ * to do its magic for it every time.
+ */
+#define NR_DCACHE 256
+#define DHASH_BITS 6
+#define NR_DHASH (1 << DHASH_BITS)
+
+struct dentry {
+    unsigned short d_dev;       /* 0: unused */
+    inr_t d_dir;
+    inr_t d_inr;                /* 0: negative */
+    char d_name[NAME_LEN];      /* 0-padded, like in a dir_entry */
+    struct dentry* d_prev;      // for the hash table
+    struct dentry* d_next;      // for the hash table
+    struct dentry* d_prev_lru;  // lru circular double-linked list
+    struct dentry* d_next_lru;  // lru circular double-linked list
+};
+
+static struct dentry dcache[NR_DCACHE];
+static struct dentry* dhash_table[NR_DHASH];
+static struct dentry* dcache_lru = NULL;    /* least recently used */
+static unsigned long dcache_seq = 0;        /* bumped by every change */
+
+static inline unsigned dhashfn(int dev, int dir, const char* name)
+{
+    unsigned h = (unsigned) dir ^ ((unsigned) dev << 16);
+    for (int i = 0; i < NAME_LEN && name[i]; ++i)
+        h = h * 31 + (unsigned char) name[i];
+    return (h * 0x9E3779B1U) >> (32 - DHASH_BITS);
+}
+#define dhash(dev,dir,name) dhash_table[dhashfn(dev,dir,name)]
+
+/* the name from user space, truncated and 0-padded to NAME_LEN */
+static void get_name(char* buf, const char* name, int namelen)
+{
+    for (int i = 0; i < NAME_LEN; ++i)
+        buf[i] = (i < namelen) ? get_fs_byte(name + i) : 0;
+}
+
+static inline bool same_name(const char* a, const char* b)
+{
+    for (int i = 0; i < NAME_LEN; ++i)
+        if (a[i] != b[i]) return false;
+    return true;
+}
+
+static void dcache_init(void)
+{
+    for (int i = 0; i < NR_DCACHE; ++i) {
+        dcache[i].d_next_lru = dcache + (i + 1) % NR_DCACHE;
+        dcache[i].d_prev_lru = dcache + (i + NR_DCACHE - 1) % NR_DCACHE;
+    }
+    dcache_lru = dcache;
+}
+
+/* to the end of the lru list (most recently used) */
+static void d_touch(struct dentry* d)
+{
+    if (d == dcache_lru) {
+        dcache_lru = d->d_next_lru;
+        return;
+    }
+    d->d_prev_lru->d_next_lru = d->d_next_lru;
+    d->d_next_lru->d_prev_lru = d->d_prev_lru;
+    d->d_next_lru = dcache_lru;
+    d->d_prev_lru = dcache_lru->d_prev_lru;
+    dcache_lru->d_prev_lru->d_next_lru = d;
+    dcache_lru->d_prev_lru = d;
+}
+
+static void d_unhash(struct dentry* d)
+{
+    if (d->d_next) d->d_next->d_prev = d->d_prev;
+    if (d->d_prev) d->d_prev->d_next = d->d_next;
+    if (dhash(d->d_dev, d->d_dir, d->d_name) == d)
+        dhash(d->d_dev, d->d_dir, d->d_name) = d->d_next;
+    d->d_prev = d->d_next = NULL;
+}
+
+/* unhashes d and puts it first in line for reuse */
+static void d_drop(struct dentry* d)
+{
+    d_unhash(d);
+    d->d_dev = 0;
+    d_touch(d);
+    dcache_lru = d;
+    ++dcache_seq;
+}
+
+static struct dentry* d_find(int dev, int dir, const char* name)
+{
+    for (struct dentry* d = dhash(dev, dir, name); d; d = d->d_next)
+        if (d->d_dev == dev && d->d_dir == dir && same_name(d->d_name, name))
+            return d;
+    return NULL;
+}
+
+static void d_add(int dev, int dir, const char* name, int inr)
+{
+    struct dentry* d = d_find(dev, dir, name);
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    if (!d) {
+        if (!dcache_lru) dcache_init();
+        d = dcache_lru;
+        if (d->d_dev) d_unhash(d);
+        /***************************************************************/
+        d->d_dev = dev;
+        d->d_dir = dir;
+        for (int i = 0; i < NAME_LEN; ++i) d->d_name[i] = name[i];
+        d->d_next = dhash(dev, dir, name);
+        dhash(dev, dir, name) = d;
+        if (d->d_next) d->d_next->d_prev = d;
+    }
+    d->d_inr = inr;
+    d_touch(d);
+}
+
+/* name (in user space) in dir has changed */
+static void dcache_invalidate(struct m_inode* dir, const char* name, 
+                              int namelen)
+{
+    char buf[NAME_LEN];
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    ++dcache_seq;       // even if it isn't cached: a lookup may be under way
+    get_name(buf, name, namelen);
+    struct dentry* d = d_find(dir->i_dev, dir->i_num, buf);
+    if (d) d_drop(d);
+}
+
+/* the entries under directory inode nr dir, or of the whole device if 0 */
+static void dcache_invalidate_dir(int dev, int dir)
+{
+    ++dcache_seq;
+    if (!dcache_lru) return;
+    for (struct dentry* d = dcache; d < dcache + NR_DCACHE; ++d)
+        if (d->d_dev == dev && (!dir || d->d_dir == dir)) d_drop(d);
+}
+
 /*
  *	add_entry()
  *
@@ -148,6 +301,7 @@ static struct buffer_head* add_entry(struct m_inode* dir,
             dir->i_dirt = 1;
             /***************************************************************/
             bh->b_dirt = 1;
+            dcache_invalidate(dir, name, namelen);
             /***************************************************************/
             return bh;
         }
@@ -244,6 +398,46 @@ static struct buffer_head* find_entry(struct m_inode** dir,
     return NULL;
 }
 
+/*
+ *	lookup()
+ *
+ * the inode nr of name in *dir, or 0 if it isn't there: find_entry()
+ * through the dentry cache, for those who don't need the entry itself.
+ * Like find_entry(), it may exchange *dir for a mounted-on directory.
+ */
+static int lookup(struct m_inode** dir, const char* name, int namelen)
+{
+#ifdef NO_TRUNCATE
+    if (namelen > NAME_LEN)
+        return 0;
+#else
+    if (namelen > NAME_LEN)
+        namelen = NAME_LEN;
+#endif
+    if (!namelen) return 0;
+    //////////////////////////////////////////////////////////////////////////
+    char buf[NAME_LEN];
+    struct dentry* d;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    get_name(buf, name, namelen);
+    bool magic = namelen == 2 && buf[0] == '.' && buf[1] == '.' &&
+                 (*dir == current->root || (*dir)->i_num == ROOT_INO);
+    if (!magic && (d = d_find((*dir)->i_dev, (*dir)->i_num, buf))) {
+        d_touch(d);
+        return d->d_inr;
+    }
+    //////////////////////////////////////////////////////////////////////////
+    unsigned long seq = dcache_seq;
+    struct dir_entry* de;
+    struct buffer_head* bh = find_entry(dir, name, namelen, &de);
+    int inr = bh ? de->inode : 0;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    if (!magic && seq == dcache_seq)
+        d_add((*dir)->i_dev, (*dir)->i_num, buf, inr);
+    brelse(bh);
+    return inr;
+}
+
 /*
  *	get_dir_i(): old name get_dir
  *
@@ -288,18 +482,15 @@ static struct m_inode* get_dir_i(const char* pathname)
         // if thisname points to basename returns its father directory's inode
         if (!c) return inode;   // if c == '\0'
         /***************************************************************/
-        struct dir_entry* de;
-        struct buffer_head* bh = find_entry(&inode, thisname, namelen, &de);
+        int inr = lookup(&inode, thisname, namelen);
         //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
-        if (!bh) {
+        if (!inr) {
             iput(inode);
             return NULL;
         }
         /***************************************************************/
-        int inr = de->inode;
         int idev = inode->i_dev;
         //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
-        brelse(bh);
         iput(inode);
         inode = iget(idev, inr);    // iget() will handle mounting
         /***************************************************************/
@@ -393,6 +584,12 @@ static bool is_empty_dir(struct m_inode* inode)
  **************************** INTERFACE **************************************
  */
 
+/* put_super(): the device's entries */
+void dcache_invalidate_dev(int dev)
+{
+    dcache_invalidate_dir(dev, 0);
+}
+
 /*
  *	namei()
  *
@@ -423,19 +620,14 @@ struct m_inode* namei(const char* pathname)
     /* special case: '/usr/' etc */
     if (!base_len) return dir;
     /***************************************************************/
-    struct dir_entry* de;
-    struct buffer_head* bh;
-    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
-    bh = find_entry(&dir, basename, base_len, &de);
-    if (!bh) {
+    int inr = lookup(&dir, basename, base_len);
+    if (!inr) {
         iput(dir);
         return NULL;
     }
     //////////////////////////////////////////////////////////////////////////
-    int inr = de->inode;
     int dev = dir->i_dev;
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
-    brelse(bh);
     iput(dir);
     /***************************************************************/
     dir = iget(dev, inr);       // iget() will handle mounting
@@ -478,11 +670,10 @@ int open_namei(const char* pathname,
     }
     /*#######################################################################*/
     /*#######################################################################*/
-    struct dir_entry* de;
     struct m_inode* inode;
-    struct buffer_head* bh = find_entry(&dir, basename, base_len, &de);
+    int inr = lookup(&dir, basename, base_len);
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
-    if (!bh) { // only for new file creation
+    if (!inr) { // only for new file creation
         if (!(flag & O_CREAT)) {
             iput(dir);
             return -ENOENT;
@@ -503,7 +694,8 @@ int open_namei(const char* pathname,
         inode->i_mode = mode;
         inode->i_dirt = 1;
         /***************************************************************/
-        bh = add_entry(dir, basename, base_len, inode->i_num);
+        struct buffer_head* bh = add_entry(dir, basename, base_len, 
+                                           inode->i_num);
         if (!bh) {
             inode->i_nlinks--;
             iput(inode);
@@ -518,10 +710,8 @@ int open_namei(const char* pathname,
         return 0;
     }
     //////////////////////////////////////////////////////////////////////////
-    int inr = de->inode;
     int dev = dir->i_dev;
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
-    brelse(bh);
     iput(dir);
     /***************************************************************/
     if (flag & O_EXCL) return -EEXIST;
@@ -639,7 +829,7 @@ int sys_mkdir(const char* pathname, int mode)
         return -ENOSPC;
     }
     /***************************************************************/
-    if (!(inode->i_zone[0] = new_block(inode->i_dev))) {
+    if (!(inode->i_zone[0] = new_block(inode->i_dev, dir->i_zone[0]))) {
         inode->i_nlinks--;
         iput(inode);
         /*******************************************************/
@@ -803,6 +993,8 @@ int sys_rmdir(const char* pathname)
     de->inode = 0;
     bh->b_dirt = 1;
     brelse(bh);
+    dcache_invalidate(dir, basename, base_len);
+    dcache_invalidate_dir(inode->i_dev, inode->i_num);
     /***************************************************************/
     inode->i_nlinks = 0;
     inode->i_dirt = 1;
@@ -865,6 +1057,7 @@ int sys_unlink(const char* name)
     de->inode = 0;
     bh->b_dirt = 1;
     brelse(bh);
+    dcache_invalidate(dir,basename,namelen);
     inode->i_nlinks--;
     inode->i_dirt = 1;
     inode->i_ctime = CURRENT_TIME;
@@ -19,9 +19,20 @@
 extern struct file file_table[NR_FILE];
 extern struct tty_struct tty_table[];
 
+/*
+ * Free blocks and inodes of a mounted device, from the counts the super
+ * block keeps: no bitmap is looked at.
+ */
 int sys_ustat(int dev, struct ustat* ubuf)
 {
-	return -ENOSYS;
+    struct super_block* sb = get_super(dev);
+    if (!sb) return -EINVAL;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    struct ustat tmp = {};
+    tmp.f_tfree = sb->s_free_zones << sb->s_log_zone_size;
+    tmp.f_tinode = sb->s_free_inodes;
+    copy_to_user(&tmp, ubuf, struct ustat);
+    return 0;
 }
 
 int sys_utime(char* filename, struct utimbuf* times)
@@ -202,6 +213,8 @@ int sys_open(const char* filename, int flag, int mode)  // mode is for create
     f->f_count = 1;
     f->f_inode = inode;
     f->f_pos = 0;
+    f->f_ra_next = f->f_ra_end = 0;
+    f->f_ra_win = 0;
     //////////////////////////////////////////////////////////////////////////
     return fd;
 }
@@ -95,6 +95,8 @@ static struct super_block* read_super(int dev)
     s->s_time = 0;
     s->s_rd_only = 0;
     s->s_dirt = 0;
+    s->s_zone_cursor = s->s_inode_cursor = 0;
+    s->s_imap_full = s->s_zmap_full = 0;
     /***************************************************************/
     lock_super(s);
     struct buffer_head* bh = bread(dev, 1);
@@ -143,6 +145,9 @@ static struct super_block* read_super(int dev)
     //////////////////////////////////////////////////////////////////////////
     s->s_imap[0]->b_data[0] |= 1;   // make sure i-node 0 is not used
     s->s_zmap[0]->b_data[0] |= 1;   // make sure zone 0 is used by the root
+    s->s_free_inodes = count_free(s->s_imap, s->s_ninodes + 1);
+    s->s_free_zones = count_free(s->s_zmap, 
+                                 s->s_nzones - s->s_firstdatazone + 1);
     unlock_super(s);
     /***************************************************************/
 #ifdef DEBUG
@@ -198,6 +203,7 @@ void put_super(int dev)
     //////////////////////////////////////////////////////////////////////////
     lock_super(sb);
     sb->s_dev = 0;
+    dcache_invalidate_dev(dev);
     int i;
     for(i = 0; i < sb->s_imap_blocks; ++i) brelse(sb->s_imap[i]);
     for(i = 0; i < sb->s_zmap_blocks; ++i) brelse(sb->s_zmap[i]);
@@ -345,6 +351,7 @@ int sys_umount(char* dev_name)
 	sb->s_isup = NULL;
 	put_super(dev);
 	sync_dev(dev);
+	invalidate_cached_pages(dev, 0);
 	return 0;
 }
 
@@ -43,6 +43,7 @@ static void free_dind(int dev, int block)
 void truncate(struct m_inode* inode)
 {   // only for regular & directory
     if (!(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode))) return;
+    invalidate_cached_pages(inode->i_dev, inode->i_num);
     //////////////////////////////////////////////////////////////////////////
     for (int i = 0; i < 7; ++i)
         if (inode->i_zone[i]) {
@@ -46,6 +46,24 @@
      _v; \
     })
 
+#define outl(value, port) \
+    __asm__ ("outl %%eax, %%dx\n\t" \
+             : \
+             : \
+             "a" (value), \
+             "d" (port) \
+            )
+
+#define inl(port) \
+    ({ \
+     unsigned long _v; \
+    __asm__ __volatile__ ("inl %%dx, %%eax\n\t" \
+                          : "=&a" (_v) \
+                          : "d" (port) \
+                         ); \
+     _v; \
+    })
+
 #define CMOS_READ(addr) \
     ({ \
         outb_p(0x80|(addr), 0x70); \
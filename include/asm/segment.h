@@ -12,32 +12,52 @@ static inline void copy_block(const char* from, char* to, size_t size)
             );
 }
 
+/*
+ * Bulk copies between user space (%fs) and kernel space (%ds == %es, see
+ * system_call): a long at a time, then the 0-3 bytes left over. The read
+ * and write paths use these rather than looping over get_fs_byte()/
+ * put_fs_byte(). The caller does the verify_area().
+ */
 static inline void copy_block_fs2es(const char* from, char* to, size_t size)
 {
-    __asm__ ("cld\n\t"
-             "fs rep movsb\n\t"
-             :
-             :
-             "S" (from), 
-             "D" (to),              // check system_call: %ds == %es
-             "c" (size)
-            );
+    int d0, d1, d2;
+    __asm__ __volatile__ ("cld\n\t"
+                          "movl %%edx, %%ecx\n\t"
+                          "shrl $2, %%ecx\n\t"
+                          "fs rep movsl\n\t"
+                          "movl %%edx, %%ecx\n\t"
+                          "andl $3, %%ecx\n\t"
+                          "fs rep movsb\n\t"
+                          : 
+                          "=&c" (d0), "=&S" (d1), "=&D" (d2)
+                          : 
+                          "d" (size), "1" (from), "2" (to)
+                          : 
+                          "memory"
+                         );
 }
 
 static inline void copy_block_ds2fs(const char* from, char* to, size_t size)
 {
-    __asm__ ("pushw %%es\n\t"
-             "pushw %%fs\n\t"
-             "popw %%es\n\t"        // set %es := %fs
-             "cld\n\t"
-             "rep movsb\n\t"
-             "popw %%es\n\t"
-             :
-             :
-             "S" (from), 
-             "D" (to), 
-             "c" (size)
-            );
+    int d0, d1, d2;
+    __asm__ __volatile__ ("pushw %%es\n\t"
+                          "pushw %%fs\n\t"
+                          "popw %%es\n\t"     // set %es := %fs
+                          "cld\n\t"
+                          "movl %%edx, %%ecx\n\t"
+                          "shrl $2, %%ecx\n\t"
+                          "rep movsl\n\t"
+                          "movl %%edx, %%ecx\n\t"
+                          "andl $3, %%ecx\n\t"
+                          "rep movsb\n\t"
+                          "popw %%es\n\t"
+                          : 
+                          "=&c" (d0), "=&S" (d1), "=&D" (d2)
+                          : 
+                          "d" (size), "1" (from), "2" (to)
+                          : 
+                          "memory"
+                         );
 }
 
 #define copy_to_user(from, to, type) \
@@ -27,6 +27,23 @@
 #define cli() __asm__ ("cli\n\t")
 #define nop() __asm__ ("nop\n\t")
 
+// save/restore the interrupt flag, for code that may be entered with
+// interrupts already disabled (ie from an interrupt handler)
+#define save_flags(x) \
+    __asm__ __volatile__ ("pushfl\n\t" \
+                          "popl %0\n\t" \
+                          : "=r" (x) \
+                          : \
+                          : "memory" \
+                         )
+#define restore_flags(x) \
+    __asm__ __volatile__ ("pushl %0\n\t" \
+                          "popfl\n\t" \
+                          : \
+                          : "r" (x) \
+                          : "memory" \
+                         )
+
 #define iret() __asm__ ("iret\n\t")
 
 /*
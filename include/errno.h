@@ -54,4 +54,4 @@ extern int errno;
 #define ENOLCK		37
 #define ENOSYS		38
 #define ENOTEMPTY	39
-
+#define EIDRM		43
@@ -4,6 +4,13 @@
  * root-device by changing the line ROOT_DEV = XXX in boot/bootsect.s
  */
 
+/*
+ * Boot-time options live in the word just before the root-device in
+ * the boot block (BOOT_FLAGS in boot/bootsect.s), so they can be
+ * changed by patching the image rather than rebuilding the kernel.
+ */
+#define BOOT_HD_DMA     0x0001  /* PCI IDE bus-master DMA for the hd */
+
 /*
  * define your keyboard here -
  * KBD_FINNISH for Finnish keyboards
@@ -39,10 +39,10 @@ void buffer_init(laddr_t buffer_end);
 #define SUPER_MAGIC 0x137F
 
 #define NR_OPEN 20
-#define NR_INODE 64
+#define NR_INODE nr_inodes  /* picked at boot, see inode_init() */
 #define NR_FILE 64
 #define NR_SUPER 8
-#define NR_HASH 307
+#define MAX_HASH 65536      /* nr_hash is picked at boot, up to this */
 #define NR_BUFFERS nr_buffers
 #define BLOCK_SIZE 1024
 #define BLOCK_SIZE_BITS 10
@@ -73,6 +73,11 @@ typedef unsigned short inr_t;
 
 typedef char buffer_block[BLOCK_SIZE];
 
+// values of b_list
+#define BUF_CLEAN 0
+#define BUF_DIRTY 1
+#define BUF_USED 2      /* b_count > 0: on no lru list */
+
 struct buffer_head {
     char* b_data;			    /* pointer to data block (1024 bytes) */
     unsigned long b_blocknr;	/* block number */
@@ -81,11 +86,13 @@ struct buffer_head {
     unsigned char b_dirt;		/* 0-clean,1-dirty */
     unsigned char b_count;		/* users using this block */
     unsigned char b_lock;		/* 0 - ok, 1 -locked */
+    unsigned char b_list;       /* lru list it's on, see fs/buffer.c */
     struct task_struct* b_wait; // the wait queue header, check sleep_on()
     struct buffer_head* b_prev; // for the hash table
     struct buffer_head* b_next; // for the hash table
-    struct buffer_head* b_prev_free;// free buffer circular double-linked list
-    struct buffer_head* b_next_free;// free buffer circular double-linked list
+    struct buffer_head* b_prev_free;// lru circular double-linked list
+    struct buffer_head* b_next_free;// lru circular double-linked list
+    struct buffer_head* b_reqnext;  // next buffer of a merged request
 };
 
 // i-node structure on disks
@@ -122,6 +129,12 @@ struct m_inode {
     unsigned char i_mount;      // to specify if a filesystem is mounted on
     unsigned char i_seek;       // for lseek ??? TO_READ
     unsigned char i_update;     // ??? TO_READ
+    unsigned char i_prealloc_count; // zones reserved for the next writes
+    unsigned short i_prealloc_zone; // the first of them, see bitmap.c
+    struct m_inode* i_prev;     // for the hash table
+    struct m_inode* i_next;     // for the hash table
+    struct m_inode* i_prev_free;// free lru or in-use circular list
+    struct m_inode* i_next_free;// free lru or in-use circular list
 };
 
 struct file {
@@ -130,6 +143,10 @@ struct file {
     unsigned short f_count;
     struct m_inode* f_inode;
     off_t f_pos;                // off_t is a synoym for long
+    /* read-ahead state, see file_read() */
+    unsigned long f_ra_next;    // block nr a sequential reader wants next
+    unsigned long f_ra_end;     // first block not read ahead yet
+    unsigned short f_ra_win;    // read-ahead window in blocks, 0: off
 };
 
 struct super_block {
@@ -156,6 +173,12 @@ struct super_block {
     unsigned char s_lock;
     unsigned char s_rd_only;
     unsigned char s_dirt;
+    unsigned short s_zone_cursor;   // zmap bit of the last zone allocated
+    unsigned short s_inode_cursor;  // imap bit of the last inode allocated
+    unsigned long s_free_zones;     // zero bits in s_zmap, kept up to date
+    unsigned long s_free_inodes;    // zero bits in s_imap, kept up to date
+    unsigned char s_imap_full;      // a bit per s_imap block known full
+    unsigned char s_zmap_full;      // a bit per s_zmap block known full
 };
 
 struct d_super_block {              // super block in the device
@@ -174,11 +197,13 @@ struct dir_entry {
     char name[NAME_LEN];            // file name
 };
 
-extern struct m_inode inode_table[NR_INODE];
+extern struct m_inode* inode_table;
+extern int nr_inodes;
 extern struct file file_table[NR_FILE];
 extern struct super_block super_block[NR_SUPER];
 extern struct buffer_head* start_buffer;
 extern int nr_buffers;
+extern int nr_hash;
 
 extern void check_disk_change(int dev);
 extern int floppy_change(unsigned int nr);
@@ -193,24 +218,33 @@ extern int bmap(struct m_inode* inode, int block);
 extern int create_block(struct m_inode* inode, int block);
 extern struct m_inode* namei(const char* pathname);
 extern struct m_inode* lnamei(const char* pathname);
+extern void dcache_invalidate_dev(int dev);
 extern int open_namei(const char* pathname, int flag, int mode,
                       struct m_inode** res_inode);
 extern void iput(struct m_inode* inode);
 extern struct m_inode* iget(int dev, int nr);
 extern struct m_inode* get_empty_inode(void);
 extern struct m_inode* get_pipe_inode(void);
+extern void insert_inode_hash(struct m_inode* inode);
+extern void clear_inode(struct m_inode* inode);
 extern struct buffer_head* get_hash_table(int dev, int block);
 extern struct buffer_head* getblk(int dev, int block);
 extern void ll_rw_block(int rw, struct buffer_head* bh);
 extern void brelse(struct buffer_head* buf);
 extern struct buffer_head* bread(int dev, int block);
 extern void bread_page(laddr_t addr, int dev, int b[4]);
+extern void bwrite_page(laddr_t addr, int dev, int b[4]);
 extern struct buffer_head* breada(int dev, int block, ...);
-extern int new_block(int dev);
+extern void bread_ahead(int dev, int block);
+extern int new_block(int dev, int goal);
+extern int new_file_block(struct m_inode* inode, int goal);
+extern void discard_prealloc(struct m_inode* inode);
+extern int count_free(struct buffer_head** maps, int nr_bits);
 extern void free_block(int dev, int block);
 extern struct m_inode* new_inode(int dev);
 extern void free_inode(struct m_inode* inode);
 extern int sync_dev(int dev);
+extern void show_buffer_stat(void);
 extern struct super_block* get_super(int dev);
 extern void put_super(int dev);
 
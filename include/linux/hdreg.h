@@ -20,6 +20,16 @@
 
 #define HD_CMD		0x3f6
 
+/* PCI IDE bus-master regs, relative to the base in BAR4 (primary channel) */
+#define BM_COMMAND	0	/* start/stop and direction */
+#define BM_STATUS	2	/* see BM_ bits below */
+#define BM_PRD		4	/* physical address of the PRD table */
+
+#define BM_START	0x01	/* in BM_COMMAND */
+#define BM_READ		0x08	/* in BM_COMMAND: device to memory */
+#define BM_ERR		0x02	/* in BM_STATUS, write 1 to clear */
+#define BM_INTR		0x04	/* in BM_STATUS, write 1 to clear */
+
 /* Bits of HD_STATUS */
 #define ERR_STAT	0x01
 #define INDEX_STAT	0x02
@@ -40,6 +50,12 @@
 #define WIN_SEEK 		0x70
 #define WIN_DIAGNOSE		0x90
 #define WIN_SPECIFY		0x91
+#define WIN_MULTREAD		0xC4	/* read sectors, one intr per block */
+#define WIN_MULTWRITE		0xC5	/* write sectors, one intr per block */
+#define WIN_SETMULT		0xC6	/* set the block size for the above */
+#define WIN_READDMA		0xC8	/* read sectors using bus-master DMA */
+#define WIN_WRITEDMA		0xCA	/* write sectors using bus-master DMA */
+#define WIN_IDENTIFY		0xEC	/* ask drive to identify itself */
 
 /* Bits for HD_ERROR */
 #define MARK_ERR	0x01	/* Bad address mark ? */
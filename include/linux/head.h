@@ -7,7 +7,8 @@ typedef struct desc_struct {
 } desc_table[256];
 
 extern unsigned long pg_dir[1024];
-extern desc_table idt,gdt;
+extern desc_table idt;
+extern struct desc_struct gdt[];    /* sized by NR_TASKS, see head.s */
 
 #define GDT_NUL 0
 #define GDT_CODE 1
@@ -7,4 +7,55 @@
 extern unsigned long get_free_page(void);
 extern unsigned long put_page(unsigned long page, unsigned long address);
 extern void free_page(unsigned long addr);
+extern void unmap_page_range(unsigned long from, unsigned long size);
+extern void refill_zero_pages(void);
+extern void invalidate_cached_pages(int dev, int ino);
+extern void update_cached_page(int dev, int ino, unsigned long pos,
+                               const char* from, int count);
+
+/* bits of a page-table entry the hardware keeps for us */
+#define PAGE_ACCESSED 0x20
+#define PAGE_DIRTY 0x40
+
+/*
+ * A file mapped with mmap(), or a shared memory segment attached with
+ * shmat(): [start, end) in the task's data segment shows the file or the
+ * segment from offset on. Unused slots have neither.
+ */
+#define NR_MMAP 8
+
+struct mmap_area {
+    unsigned long start, end;
+    unsigned long offset;
+    struct m_inode* inode;
+    struct shm_segment* shm;
+    unsigned short prot, flags;     /* PROT_* and MAP_* of <sys/mman.h> */
+};
+
+#define MMAP_USED(m) ((m)->inode || (m)->shm)
+
+struct task_struct;
+
+/* mm/memory.c */
+extern void sync_mmap_pages(struct task_struct* p, struct mmap_area* m,
+                            unsigned long from, unsigned long to);
+/* mm/mmap.c */
+extern struct mmap_area* find_mmap(struct task_struct* p, 
+                                   unsigned long from, unsigned long to);
+extern long new_mmap(unsigned long addr, unsigned long len, int fixed,
+                     struct mmap_area** area);
+extern int do_munmap(unsigned long start, unsigned long end);
+extern void copy_mmap(struct task_struct* p);
+extern void exit_mmap(void);
+extern void sync_mmaps(void);
+/* mm/shm.c */
+extern unsigned long shm_page(struct shm_segment* shp, unsigned long nr);
+extern void shm_attach(struct shm_segment* shp);
+extern void shm_detach(struct shm_segment* shp);
+
+/* mm/swap.c: a non-present, non-zero entry holds (swap page nr << 1) */
+extern int get_swap_page(void);
+extern void swap_free(int nr);
+extern void read_swap_page(int nr, unsigned long page);
+extern void write_swap_page(int nr, unsigned long page);
 
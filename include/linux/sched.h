@@ -1,8 +1,47 @@
 #pragma once
 
-#define NR_TASKS 64
+#ifndef NR_TASKS
+#define NR_TASKS 64     /* normally set in BUILD_CONFIG.mk */
+#endif
 #define HZ 100
 
+/*
+ * Each task but task 0 has a page directory of its own (tss.cr3, loaded
+ * by the task switch). The first KERNEL_SPACE of every directory is the
+ * kernel's, identity-mapped and shared; the task gets the rest of the
+ * linear space, TASK_SIZE from TASK_BASE. Task 0 runs in the kernel's
+ * own directory, at 0. TASK_BASE is a multiple of 4Mb (one
+ * page-directory entry), as copy_page_tables() and free_page_tables()
+ * want.
+ *
+ * KERNEL_SPACE is also the most physical memory we can use: more of it
+ * means less for the tasks.
+ */
+#ifndef KERNEL_SPACE
+#define KERNEL_SPACE 0x4000000  /* 64Mb */
+#endif
+#define TASK_SIZE ((unsigned long) (0x100000000ULL - KERNEL_SPACE))
+#define TASK_BASE(nr) ((nr) ? KERNEL_SPACE : 0)
+
+/*
+ * Within that space: text and data from 0, the heap after them up to brk,
+ * and the stack at the top, growing down to at most rlim[RLIMIT_STACK]
+ * below TASK_SIZE (with no limit, down to whatever the heap leaves). The
+ * heap stays STACK_GUARD clear of the stack's reach; a fault in between
+ * is an error, not a new page.
+ */
+#define _STK_LIM 0x800000       /* 8Mb, the default stack limit */
+#define STACK_GUARD 0x10000     /* 64kB */
+#define STACK_BOTTOM(p) ((p)->rlim[RLIMIT_STACK].rlim_cur >= RLIM_INFINITY ? \
+                         0 : TASK_SIZE - (p)->rlim[RLIMIT_STACK].rlim_cur)
+
+#if (KERNEL_SPACE & 0x3fffff) || KERNEL_SPACE < 0x1000000
+#error "KERNEL_SPACE must be a multiple of 4Mb, and at least 16Mb"
+#endif
+#if (NR_TASKS < 2 || 4 + 2 * NR_TASKS > 8192)
+#error "NR_TASKS out of range: the GDT holds at most 8192 descriptors"
+#endif
+
 #define FIRST_TASK task[0]
 #define LAST_TASK task[NR_TASKS-1]
 
@@ -10,6 +49,7 @@
 #include <linux/fs.h>
 #include <linux/mm.h>
 #include <signal.h>
+#include <sys/resource.h>
 
 #if (NR_OPEN > 32)
 #error "Currently the close-on-exec-flags are in one word, max 32 files/proc"
@@ -27,11 +67,15 @@
 
 /* defined in mm/memory.c */
 extern int copy_page_tables(unsigned long from, unsigned long to, 
-                            unsigned long size);
+                            unsigned long size, struct task_struct* p);
 extern int free_page_tables(unsigned long from, unsigned long size);
+extern unsigned long new_page_dir(void);
+extern void free_page_dir(struct task_struct* p);
 /* defined in kernel/sched.c */
 extern void sched_init(void);
 extern void schedule(void);
+/* defined in kernel/fork.c */
+extern void free_task_slot(int nr);
 /* defined in kernel/trap.c */
 extern void trap_init(void);
 /* defined in kernel/panic.c */
@@ -97,6 +141,9 @@ struct task_struct {
 	long alarm;
 	long utime, stime, cutime, cstime, start_time;
 	unsigned short used_math;
+	struct rlimit rlim[RLIM_NLIMITS];
+	long rss;                   /* pages mapped, counted in mm/memory.c */
+	struct mmap_area mmap[NR_MMAP];
     /***************************************************************/
     /* file system info */
 	int tty;                    /* -1 if no tty, so it must be signed */
@@ -112,6 +159,13 @@ struct task_struct {
     /***************************************************************/
     /* tss for this task */
 	struct tss_struct tss;
+    /***************************************************************/
+    /* scheduler links, only touched by kernel/sched.c */
+	struct task_struct* next_run, * prev_run;
+	struct prio_array* array;       /* run queue we're on, NULL if none */
+	long rq_level;                  /* index into array->queue[] */
+	unsigned long epoch;            /* last counter recalculation seen */
+	struct task_struct* next_alarm; /* alarm list, sorted by ->alarm */
 };
 
 /*
@@ -158,6 +212,9 @@ struct task_struct {
  * start_time = 0;
  *
  * used_math = 0;
+ * rlim[] = infinity, but an 8Mb stack;
+ * rss = 0;
+ * mmap[NR_MMAP] = {};
  *
  * tty = -1;  it doesn't use any tty
  * umask = 0022;
@@ -221,6 +278,11 @@ struct task_struct {
 /* uid etc */	0,0,0,0,0,0, \
 /* alarm */	0,0,0,0,0,0, \
 /* math */	0, \
+/* rlimits */	{ {RLIM_INFINITY, RLIM_INFINITY}, {RLIM_INFINITY, RLIM_INFINITY}, \
+		  {RLIM_INFINITY, RLIM_INFINITY}, {_STK_LIM, RLIM_INFINITY}, \
+		  {RLIM_INFINITY, RLIM_INFINITY}, {RLIM_INFINITY, RLIM_INFINITY} }, \
+/* rss */	0, \
+/* mmap */	{}, \
 /* fs info */	-1,0022,NULL,NULL,NULL,0, \
 /* filp */	{NULL,}, \
 	{ \
@@ -249,6 +311,9 @@ extern void add_timer(long jiffies, void (*fn)(void));
 extern void sleep_on(struct task_struct** p);
 extern void interruptible_sleep_on(struct task_struct** p);
 extern void wake_up(struct task_struct** p);
+extern void wake_up_process(struct task_struct* p);
+extern void signal_wake_up(struct task_struct* p);
+extern void set_alarm(struct task_struct* p, long when);
 
 /*
  * Entry into gdt where to find first TSS. 0-nul, 1-cs, 2-ds, 3-syscall
@@ -264,6 +329,9 @@ extern void wake_up(struct task_struct** p);
 #define _TSS(n) ((((unsigned long) n)<<4) + (FIRST_TSS_ENTRY<<3))
 #define _LDT(n) ((((unsigned long) n)<<4) + (FIRST_LDT_ENTRY<<3))
 
+// the task nr of a task_struct, recovered from its LDT selector
+#define _TASK_NR(p) (((p)->tss.ldt - (FIRST_LDT_ENTRY<<3)) >> 4)
+
 #define ltr(n) \
     __asm__ ("ltr %%ax\n\t" \
              : \
@@ -0,0 +1,17 @@
+#pragma once
+
+/*
+ * Object caches for the kernel, see lib/malloc.c. A cache hands out
+ * objects of one size, carved from pages of their own (slabs). If it has
+ * a constructor, objects are constructed once, when their slab is got,
+ * and must be freed in their constructed state.
+ */
+struct kmem_cache;
+
+extern struct kmem_cache* kmem_cache_create(const char* name,
+                                            unsigned int size,
+                                            void (*ctor)(void*));
+extern int kmem_cache_destroy(struct kmem_cache* cachep);
+extern void* kmem_cache_alloc(struct kmem_cache* cachep);
+extern void kmem_cache_free(struct kmem_cache* cachep, void* obj);
+extern void kmem_cache_stats(void);
@@ -104,6 +104,13 @@ extern int sys_uselib();
 extern int sys_swapon();
 extern int sys_reboot();
 extern int sys_readdir();
+extern int sys_bdflush();
+extern int sys_mmap();
+extern int sys_munmap();
+extern int sys_shmget();
+extern int sys_shmat();
+extern int sys_shmdt();
+extern int sys_shmctl();
 
 fn_ptr sys_call_table[] = { sys_setup, sys_exit, sys_fork, sys_read,
 sys_write, sys_open, sys_close, sys_waitpid, sys_creat, sys_link,
@@ -120,7 +127,9 @@ sys_getpgrp, sys_setsid, sys_sigaction, sys_sgetmask, sys_ssetmask,
 sys_setreuid,sys_setregid, sys_sigsuspend, sys_sigpending, sys_sethostname,
 sys_setrlimit, sys_getrlimit, sys_getrusage, sys_gettimeofday, 
 sys_settimeofday, sys_getgroups, sys_setgroups, sys_select, sys_symlink,
-sys_lstat, sys_readlink, sys_uselib, sys_swapon, sys_reboot, sys_readdir };
+sys_lstat, sys_readlink, sys_uselib, sys_swapon, sys_reboot, sys_readdir,
+sys_bdflush, sys_mmap, sys_munmap, sys_shmget, sys_shmat, sys_shmdt,
+sys_shmctl };
 
 /* So we don't have to do any more manual updating.... */
 int NR_syscalls = sizeof(sys_call_table)/sizeof(fn_ptr);
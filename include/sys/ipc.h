@@ -0,0 +1,28 @@
+#ifndef _SYS_IPC_H
+#define _SYS_IPC_H
+
+#include <sys/types.h>
+
+struct ipc_perm {
+	key_t key;
+	ushort uid;	/* owner */
+	ushort gid;
+	ushort cuid;	/* creator */
+	ushort cgid;
+	ushort mode;	/* rwx like a file's, only r and w mean anything */
+	ushort seq;	/* slot usage sequence number */
+};
+
+#define IPC_PRIVATE	((key_t) 0)
+
+/* get flags */
+#define IPC_CREAT	00001000	/* create if key is nonexistent */
+#define IPC_EXCL	00002000	/* fail if key exists */
+#define IPC_NOWAIT	00004000	/* return error on wait */
+
+/* ctl commands */
+#define IPC_RMID	0	/* remove resource */
+#define IPC_SET		1	/* set ipc_perm options */
+#define IPC_STAT	2	/* get ipc_perm options */
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef _SYS_MMAN_H
+#define _SYS_MMAN_H
+
+#include <sys/types.h>
+
+#define PROT_NONE	0x0
+#define PROT_READ	0x1
+#define PROT_EXEC	0x4
+#define PROT_WRITE	0x2
+
+#define MAP_SHARED	0x01	/* writes go to the file */
+#define MAP_PRIVATE	0x02	/* writes are copied */
+#define MAP_TYPE	0x0f
+#define MAP_FIXED	0x10	/* exactly at addr */
+
+#define MAP_FAILED	((void*) -1)
+
+/* sys_mmap() takes its six arguments from a block in user space */
+struct mmap_arg_struct {
+	unsigned long addr;
+	unsigned long len;
+	unsigned long prot;
+	unsigned long flags;
+	unsigned long fd;
+	unsigned long offset;
+};
+
+extern void* mmap(void* addr, size_t len, int prot, int flags, int fd,
+		  off_t offset);
+extern int munmap(void* addr, size_t len);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef _SYS_RESOURCE_H
+#define _SYS_RESOURCE_H
+
+/*
+ * Resource limits. Only RLIMIT_DATA, RLIMIT_STACK and RLIMIT_RSS are
+ * enforced so far; the others are just kept.
+ */
+#define RLIMIT_CPU	0	/* cpu time in seconds */
+#define RLIMIT_FSIZE	1	/* maximum file size */
+#define RLIMIT_DATA	2	/* data + heap, in bytes */
+#define RLIMIT_STACK	3	/* stack, in bytes */
+#define RLIMIT_CORE	4	/* core file size */
+#define RLIMIT_RSS	5	/* resident pages, in bytes */
+
+#define RLIM_NLIMITS	6
+
+#define RLIM_INFINITY	0x7fffffff
+
+struct rlimit {
+	long rlim_cur;
+	long rlim_max;
+};
+
+extern int getrlimit(int resource, struct rlimit* rlp);
+extern int setrlimit(int resource, struct rlimit* rlp);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef _SYS_SHM_H
+#define _SYS_SHM_H
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+
+#define SHMMAX	0x400000	/* 4Mb: the most a segment can be */
+#define SHMMIN	1
+#define SHMMNI	16		/* segments in the system */
+
+#define SHM_RDONLY	010000	/* shmat(): attach read-only */
+
+struct shmid_ds {
+	struct ipc_perm shm_perm;
+	int shm_segsz;		/* size in bytes */
+	time_t shm_atime;	/* last attach */
+	time_t shm_dtime;	/* last detach */
+	time_t shm_ctime;	/* last change */
+	pid_t shm_cpid;		/* creator */
+	pid_t shm_lpid;		/* last operation */
+	short shm_nattch;	/* attachments */
+};
+
+extern int shmget(key_t key, int size, int shmflg);
+extern void* shmat(int shmid, const void* shmaddr, int shmflg);
+extern int shmdt(const void* shmaddr);
+extern int shmctl(int shmid, int cmd, struct shmid_ds* buf);
+
+#endif
@@ -46,6 +46,7 @@ typedef unsigned char nlink_t;
 typedef int daddr_t;
 typedef unsigned long laddr_t;      // logical address
 typedef long off_t;
+typedef int key_t;
 typedef unsigned char u_char;
 typedef unsigned short ushort;
 
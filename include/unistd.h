@@ -147,6 +147,13 @@
 #define __NR_swapon	    87
 #define __NR_reboot	    88
 #define __NR_readdir	89
+#define __NR_bdflush	90
+#define __NR_mmap	    91
+#define __NR_munmap	    92
+#define __NR_shmget	    93
+#define __NR_shmat	    94
+#define __NR_shmdt	    95
+#define __NR_shmctl	    96
 
 // no arguement
 #define _syscall0(type, name) \
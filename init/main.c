@@ -8,6 +8,7 @@
 #include <unistd.h>
 #include <time.h>
 
+#include <linux/config.h>
 #include <linux/tty.h>
 #include <linux/sched.h>
 #include <linux/head.h>
@@ -45,6 +46,8 @@ inline _syscall0(int, pause)
 static inline _syscall1(int, setup, void*, BIOS)
 //inline int sync(): sys_sync :to sync filesystem
 inline _syscall0(int, sync)
+//static inline int bdflush(): sys_bdflush: never returns
+static inline _syscall0(int, bdflush)
 
 static char printbuf[1024];
 
@@ -54,10 +57,11 @@ extern int vsprintf(char* buf, const char* fmt, va_list args);
 extern void init(void);
 extern void blk_dev_init(void);
 extern void chr_dev_init(void);
-extern void hd_init(void);
+extern void hd_init(int dma);
 extern void floppy_init(void);
 extern void mem_init(long start, long end);
 extern long rd_init(long mem_start, int length);
+extern long inode_init(long mem_start, long mem_end);
 extern time_t kernel_mktime(struct tm * tm);
 extern time_t startup_time;
 
@@ -66,6 +70,9 @@ extern time_t startup_time;
  */
 #define EXT_MEM_K (*(unsigned short *)0x90002)
 #define DRIVE_INFO (*(struct drive_info *)0x90080)
+#define E801_MEM_K (*(unsigned short *)0x901F0)
+#define E801_MEM_64K (*(unsigned short *)0x901F2)
+#define ORIG_BOOT_FLAGS (*(unsigned short *)0x901FA)
 #define ORIG_ROOT_DEV (*(unsigned short *)0x901FC)
 
 /*
@@ -126,11 +133,26 @@ void main(void)     /* This really IS void, no error here. */
     ROOT_DEV = ORIG_ROOT_DEV;
     drive_info = DRIVE_INFO;                /* get driver information */
     ///////////////////////////////////////////////////////////////////////////
-    memory_end = (1<<20) + (EXT_MEM_K<<10); /* see int 0x15,88 */
+    if (E801_MEM_K) {                       /* see int 0x15,e801 */
+        // 64kB blocks above 16MB: clamp first, ~4GB would wrap to 0
+        laddr_t high = E801_MEM_64K;
+        if (high > (KERNEL_SPACE - 16*1024*1024) >> 16)
+            high = (KERNEL_SPACE - 16*1024*1024) >> 16;
+        memory_end = (1<<20) + (E801_MEM_K<<10) + (high<<16);
+    }
+    else
+        memory_end = (1<<20) + (EXT_MEM_K<<10); /* see int 0x15,88 */
     memory_end &= 0xfffff000;               /* end at 4kb boundary */
-    if (memory_end > 16*1024*1024) memory_end = 16*1024*1024; // limit to 16MB
+    if (memory_end > KERNEL_SPACE)          // all we can map
+        memory_end = KERNEL_SPACE;
     ///////////////////////////////////////////////////////////////////////////
-    if (memory_end > 12*1024*1024) 
+    // an eighth of memory for buffers on big machines, at most 16MB
+    if (memory_end > 32*1024*1024) {
+        buffer_memory_end = (memory_end >> 3) & 0xfffff000;
+        if (buffer_memory_end > 16*1024*1024) 
+            buffer_memory_end = 16*1024*1024;
+    }
+    else if (memory_end > 12*1024*1024) 
         buffer_memory_end = 4*1024*1024;
     else if (memory_end > 6*1024*1024)
         buffer_memory_end = 2*1024*1024;
@@ -139,8 +161,12 @@ void main(void)     /* This really IS void, no error here. */
     ///////////////////////////////////////////////////////////////////////////
     main_memory_start = buffer_memory_end;  // where user memory started
 #ifdef RAMDISK
-    main_memory_start += rd_init(main_memory_start, RAMDISK*1024);
+    // don't let the ramdisk take more than a quarter of memory
+    main_memory_start += rd_init(main_memory_start, 
+                                 RAMDISK*1024 < (memory_end>>2) ? 
+                                 RAMDISK*1024 : (memory_end>>2));
 #endif
+    main_memory_start += inode_init(main_memory_start, memory_end);
     mem_init(main_memory_start, memory_end);
     ///////////////////////////////////////////////////////////////////////////
     trap_init();
@@ -154,7 +180,7 @@ void main(void)     /* This really IS void, no error here. */
     sched_init();       /* system calls are initiated here */
     ///////////////////////////////////////////////////////////////////////////
     buffer_init(buffer_memory_end); 
-    hd_init();
+    hd_init(ORIG_BOOT_FLAGS & BOOT_HD_DMA);
     floppy_init();      // TO_READ
     ///////////////////////////////////////////////////////////////////////////
     sti();  /* enable interrupts */
@@ -198,22 +224,29 @@ void init() // run by process 1
     (void) open("/dev/tty0", O_RDWR, 0);    // filp[0]
     (void) dup(0);	// dup.c, filp[1]
     (void) dup(0);  // filp[2]
-    printf("%d buffers = %d bytes buffer space\n\r", 
+    printf("%d buffers = %d bytes buffer space, %d hash buckets\n\r", 
            NR_BUFFERS,
-           NR_BUFFERS * BLOCK_SIZE);
+           NR_BUFFERS * BLOCK_SIZE,
+           nr_hash);
+    printf("%d in-core inodes\n\r", NR_INODE);
     printf("Free mem: %d bytes\n\r", memory_end - main_memory_start);
     //////////////////////////////////////////////////////////////////////////
+    if (!fork()) { /* child process of process 1: the buffer flusher */
+        bdflush();
+        _exit(1);   // only if it couldn't start
+    }
+    //////////////////////////////////////////////////////////////////////////
     int pid = 0;
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
-    if (!(pid = fork())) { /* child process of process 1: process 2 */
+    if (!(pid = fork())) { /* child process of process 1: process 3 */
         close(0);   // close.c, sys_close(), close filp[0]	
         if (open("/etc/rc", O_RDONLY, 0)) _exit(1); // filp[0]
         execve("/bin/sh", argv_rc, envp_rc);    // execve.c, sys_execve()
         _exit(2);
         // NOTE!!! /etc/rc runs a script name /etc/update in the background
-        // and that's the process 3. I don't know what's that script for?
+        // and that's the process 4. I don't know what's that script for?
         // (You can comment it out, and the next process will start
-        // at 3 not 4.) by Henry
+        // at 4 not 5.) by Henry
     }
     //////////////////////////////////////////////////////////////////////////
     int i;
@@ -231,7 +264,7 @@ void init() // run by process 1
             continue;
         }
         /*****************************************************/
-        if (!pid) { // child process of process 1: process N (4..)
+        if (!pid) { // child process of process 1: process N (5..)
             close(0); close(1); close(2);   // close all tty filp
             setsid();   // setsid.c: sys_setsid()
             (void) open("/dev/tty0", O_RDWR, 0);
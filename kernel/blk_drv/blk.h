@@ -13,11 +13,23 @@
  */
 #define NR_REQUEST	32
 
+/*
+ * Upper bound on the size of a merged request, in sectors. The ATA
+ * sector count register is 8 bits, and every buffer in a request stays
+ * locked until the whole request is done, so don't make it too large.
+ */
+#define MAX_SECTORS 64
+
 /*
  * Ok, this is an expanded form so that we can use the same
  * request for paging requests when that is implemented. In
  * paging, 'bh' is NULL, and 'waiting' is used to wait for
  * read/write completion.
+ *
+ * A request may cover several buffers of consecutive blocks, chained
+ * through b_reqnext from 'bh' to 'bhtail'. 'sector' and 'nr_sectors'
+ * describe what is left of the whole request, 'buffer' and
+ * 'current_nr_sectors' what is left of the first buffer.
  */
 struct request {
     int dev;		/* -1 if no request */
@@ -25,9 +37,11 @@ struct request {
     int errors;
     unsigned long sector;
     unsigned long nr_sectors;
+    unsigned long current_nr_sectors;
     char* buffer;
     struct task_struct* waiting;
     struct buffer_head* bh;
+    struct buffer_head* bhtail;
     struct request* next;
 };
 
@@ -117,21 +131,40 @@ static inline void unlock_buffer(struct buffer_head* bh)
 }
 #endif 
 
+/*
+ * Finishes the first buffer of CURRENT. If the request was merged and has
+ * more buffers, it stays at the head of the queue, positioned at the next
+ * buffer; otherwise it is retired and CURRENT moves on.
+ */
 static inline void end_request(int uptodate)
 {
-    DEVICE_OFF(CURRENT->dev);   // only for floppy drives
-    /***************************************************************/
-    if (CURRENT->bh) {
-        CURRENT->bh->b_uptodate = uptodate;
-        unlock_buffer(CURRENT->bh);
-    }
+    struct buffer_head* bh = CURRENT->bh;
     /***************************************************************/
     if (!uptodate) {
         printk(DEVICE_NAME " I/O error\n\r");
-        printk("dev %04x, block %d\n\r",CURRENT->dev,
-               CURRENT->bh->b_blocknr);
+        printk("dev %04x, block %d\n\r", CURRENT->dev,
+               bh ? bh->b_blocknr : CURRENT->sector >> 1);
+    }
+    /***************************************************************/
+    if (bh) {
+        CURRENT->bh = bh->b_reqnext;
+        bh->b_reqnext = NULL;
+        bh->b_uptodate = uptodate;
+        unlock_buffer(bh);
+        /*******************************************************/
+        if ((bh = CURRENT->bh)) {
+            // skip whatever is left of the finished buffer (on errors)
+            unsigned long sector = bh->b_blocknr << 1;
+            CURRENT->nr_sectors -= sector - CURRENT->sector;
+            CURRENT->sector = sector;
+            CURRENT->current_nr_sectors = 2;
+            CURRENT->buffer = bh->b_data;
+            CURRENT->errors = 0;
+            return;
+        }
     }
     //////////////////////////////////////////////////////////////////////////
+    DEVICE_OFF(CURRENT->dev);   // only for floppy drives
     wake_up(&CURRENT->waiting);
     wake_up(&wait_for_request);
     /***************************************************************/
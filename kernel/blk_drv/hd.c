@@ -28,11 +28,19 @@
 /* Max read/write errors/sector */
 #define MAX_ERRORS	7
 #define MAX_HD		2
+/* Max sectors per interrupt we ask for with WIN_SETMULT */
+#define MAX_MULT	16
 
 static void recal_intr(void);
+static void dma_intr(void);
 
 static int recalibrate = 0;
 static int reset = 0;
+static int setmult = 0;     /* drives that lost their block size in a reset */
+
+/* sectors per interrupt of the command in progress, sectors in flight */
+static unsigned int hd_mult = 1;
+static unsigned int hd_nsent = 0;
 
 /*
  *  This struct defines the HD's and their types.
@@ -44,6 +52,7 @@ struct hd_i_struct {
     int wpcom;
     int lzone;
     int ctl;
+    int mult;   /* sectors per block for WIN_MULTREAD/WRITE, 0 if unused */
 };
 
 #ifdef HD_TYPE
@@ -61,6 +70,20 @@ static struct hd_struct {
 	long nr_sects;
 } hd[5 * MAX_HD] = {};
 
+/*
+ * Bus-master DMA on the primary channel of a PCI IDE controller.
+ * hd_dma_base is the bus-master I/O base, 0 when DMA isn't wanted,
+ * isn't there, or has been given up after an error. A request has at
+ * most MAX_SECTORS/2 buffers, one PRD entry each: 1KB buffers never
+ * cross a 64KB boundary, and the aligned table doesn't either.
+ */
+static unsigned short hd_dma_base = 0;
+static struct prd {
+    unsigned long addr;
+    unsigned long count;    /* byte count in the low 16 bits, EOT in bit 31 */
+} prd_table[MAX_SECTORS/2] __attribute__ ((aligned (256)));
+#define PRD_EOT 0x80000000
+
 // insw: input from port to string (16-bit version)
 #define port_read(port, buf, nr) \
     __asm__ ("cld\n\t" \
@@ -156,6 +179,7 @@ static void reset_controller(void)
 static void reset_hd(int nr)
 {
     reset_controller();
+    setmult = (1 << NR_HD) - 1;     // the reset cleared the block sizes
     hd_out(nr,hd_info[nr].sect,hd_info[nr].sect,hd_info[nr].head-1,
            hd_info[nr].cyl,WIN_SPECIFY,&recal_intr);
 }
@@ -167,6 +191,50 @@ static void bad_rw_intr(void)
     if (CURRENT->errors > MAX_ERRORS/2) reset = 1;
 }
 
+/*
+ * Moves CURRENT past nsect transferred sectors, finishing the buffers of
+ * a merged request as they fill up. Returns false once the whole request
+ * has been retired.
+ */
+static bool hd_advance(unsigned int nsect)
+{
+    CURRENT->errors = 0;
+    while (nsect--) {
+        CURRENT->buffer += 512;
+        CURRENT->sector++;
+        if (!--CURRENT->nr_sectors) {
+            end_request(1);
+            return false;
+        }
+        if (!--CURRENT->current_nr_sectors) end_request(1);
+    }
+    return true;
+}
+
+/*
+ * Feeds the controller the next block (hd_mult sectors at most) of
+ * CURRENT. The request itself is only advanced when the interrupt says
+ * the block is on the disk, so walk the buffer chain by hand here.
+ */
+static void write_block(void)
+{
+    char* buf = CURRENT->buffer;
+    unsigned long left = CURRENT->current_nr_sectors;
+    struct buffer_head* bh = CURRENT->bh;
+    /***************************************************************/
+    hd_nsent = CURRENT->nr_sectors < hd_mult ? CURRENT->nr_sectors : hd_mult;
+    for (unsigned int i = 0; i < hd_nsent; ++i) {
+        if (!left) {
+            bh = bh->b_reqnext;
+            buf = bh->b_data;
+            left = 2;
+        }
+        port_write(HD_DATA, buf, 256);
+        buf += 512;
+        --left;
+    }
+}
+
 static void read_intr(void)
 {
 	if (win_result()) {
@@ -174,16 +242,16 @@ static void read_intr(void)
 		do_hd_request();
 		return;
 	}
-	port_read(HD_DATA,CURRENT->buffer,256);
-	CURRENT->errors = 0;
-	CURRENT->buffer += 512;
-	CURRENT->sector++;
-	if (--CURRENT->nr_sectors) {
-		do_hd = &read_intr;
-		return;
+	unsigned int n = CURRENT->nr_sectors < hd_mult ? CURRENT->nr_sectors 
+	                                               : hd_mult;
+	while (n--) {
+		port_read(HD_DATA,CURRENT->buffer,256);
+		if (!hd_advance(1)) {
+			do_hd_request();
+			return;
+		}
 	}
-	end_request(1);
-	do_hd_request();
+	do_hd = &read_intr;
 }
 
 static void write_intr(void)
@@ -193,14 +261,39 @@ static void write_intr(void)
 		do_hd_request();
 		return;
 	}
-	if (--CURRENT->nr_sectors) {
-		CURRENT->sector++;
-		CURRENT->buffer += 512;
+	if (hd_advance(hd_nsent)) {
 		do_hd = &write_intr;
-		port_write(HD_DATA,CURRENT->buffer,256);
+		write_block();
 		return;
 	}
-	end_request(1);
+	do_hd_request();
+}
+
+static void setmult_intr(void)
+{
+	if (win_result()) {
+		printk("hd%d: can't restore multiple mode\n\r", CURRENT_DEV);
+		hd_info[CURRENT_DEV].mult = 0;
+	}
+	do_hd_request();
+}
+
+/*
+ * The whole request moved in one go: finish all of its buffers.
+ */
+static void dma_intr(void)
+{
+	outb(inb(hd_dma_base + BM_COMMAND) & ~BM_START, hd_dma_base + BM_COMMAND);
+	unsigned char stat = inb(hd_dma_base + BM_STATUS);
+	outb(stat | BM_ERR | BM_INTR, hd_dma_base + BM_STATUS);
+	if (win_result() || (stat & BM_ERR)) {
+		printk("hd: DMA error, using PIO from now on\n\r");
+		hd_dma_base = 0;
+		bad_rw_intr();
+		do_hd_request();
+		return;
+	}
+	hd_advance(CURRENT->nr_sectors);
 	do_hd_request();
 }
 
@@ -211,6 +304,117 @@ static void recal_intr(void)
 	do_hd_request();
 }
 
+/*
+ * Asks the drive for its IDENTIFY data and, if it can do READ/WRITE
+ * MULTIPLE, sets the largest power-of-two block size it allows (up to
+ * MAX_MULT). Runs before interrupts are wanted, so it polls with the
+ * drive's interrupt masked (nIEN). Returns the block size, 0 if none.
+ */
+static int hd_set_multiple(int drive)
+{
+    unsigned short id[256];
+    int mult = 0;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    outb_p(hd_info[drive].ctl | 2, HD_CMD);
+    if (!controller_ready()) goto out;
+    outb_p(0xA0 | (drive<<4), HD_CURRENT);
+    outb(WIN_IDENTIFY, HD_COMMAND);
+    if (!controller_ready() || (inb_p(HD_STATUS) & (ERR_STAT | DRQ_STAT))
+                               != DRQ_STAT)
+        goto out;
+    port_read(HD_DATA, id, 256);
+    /***************************************************************/
+    int max = id[47] & 0xff;        // max sectors per READ/WRITE MULTIPLE
+    for (mult = MAX_MULT; mult > max; mult >>= 1) ;
+    if (mult < 2) {
+        mult = 0;
+        goto out;
+    }
+    /***************************************************************/
+    outb_p(mult, HD_NSECTOR);
+    outb_p(0xA0 | (drive<<4), HD_CURRENT);
+    outb(WIN_SETMULT, HD_COMMAND);
+    if (!controller_ready() || (inb_p(HD_STATUS) & ERR_STAT)) mult = 0;
+    //////////////////////////////////////////////////////////////////////////
+out:
+    outb_p(hd_info[drive].ctl, HD_CMD);
+    return mult;
+}
+
+/*
+ * Builds the PRD table for what is left of CURRENT and starts the
+ * transfer: the first buffer may be partly done (after an error), the
+ * others are whole.
+ */
+static void hd_dma_start(unsigned int drive, unsigned int nsect, 
+                         unsigned int sec, unsigned int head, 
+                         unsigned int cyl)
+{
+    struct prd* p = prd_table;
+    p->addr = (unsigned long) CURRENT->buffer;
+    p->count = CURRENT->current_nr_sectors << 9;
+    /***************************************************************/
+    struct buffer_head* bh = CURRENT->bh;
+    unsigned long left = CURRENT->nr_sectors - CURRENT->current_nr_sectors;
+    for (; left; left -= 2) {
+        bh = bh->b_reqnext;
+        ++p;
+        p->addr = (unsigned long) bh->b_data;
+        p->count = BLOCK_SIZE;
+    }
+    p->count |= PRD_EOT;
+    //////////////////////////////////////////////////////////////////////////
+    bool read = (CURRENT->cmd == READ);
+    outl((unsigned long) prd_table, hd_dma_base + BM_PRD);
+    outb(read ? BM_READ : 0, hd_dma_base + BM_COMMAND);
+    outb(inb(hd_dma_base + BM_STATUS) | BM_ERR | BM_INTR, 
+         hd_dma_base + BM_STATUS);
+    hd_out(drive, nsect, sec, head, cyl, 
+           read ? WIN_READDMA : WIN_WRITEDMA, &dma_intr);
+    outb(inb(hd_dma_base + BM_COMMAND) | BM_START, hd_dma_base + BM_COMMAND);
+}
+
+static unsigned long pci_read(int dev, int fn, int reg)
+{
+    outl(0x80000000 | (dev<<11) | (fn<<8) | (reg & 0xfc), 0xCF8);
+    return inl(0xCFC);
+}
+
+static void pci_write(int dev, int fn, int reg, unsigned long val)
+{
+    outl(0x80000000 | (dev<<11) | (fn<<8) | (reg & 0xfc), 0xCF8);
+    outl(val, 0xCFC);
+}
+
+/*
+ * Looks on PCI bus 0 for an IDE controller that can do bus-master DMA
+ * and drives its primary channel at the legacy ports we use. Returns
+ * its bus-master I/O base, 0 if there is none.
+ */
+static unsigned short hd_dma_probe(void)
+{
+    for (int dev = 0; dev < 32; ++dev)
+        for (int fn = 0; fn < 8; ++fn) {
+            unsigned long id = pci_read(dev, fn, 0x00);
+            if ((id & 0xffff) == 0xffff) {
+                if (!fn) break;     // no device here
+                continue;
+            }
+            /*******************************************************/
+            // class 01 (storage), subclass 01 (IDE), prog-if: bit 7 
+            // bus master, bit 0 primary channel in native mode
+            unsigned long class = pci_read(dev, fn, 0x08) >> 8;
+            if ((class & 0xffff80) != 0x010180 || (class & 1)) continue;
+            unsigned long bar4 = pci_read(dev, fn, 0x20);
+            if (!(bar4 & 1)) continue;  // must be I/O space
+            /*******************************************************/
+            // turn on I/O decoding and bus mastering
+            pci_write(dev, fn, 0x04, pci_read(dev, fn, 0x04) | 0x05);
+            return bar4 & 0xfffc;
+        }
+    return 0;
+}
+
 /*
  **************************** INTERFACE **************************************
  */
@@ -274,6 +478,13 @@ int sys_setup(void* BIOS)
         hd[i*5].start_sect = 0;
         hd[i*5].nr_sects = 0;
 	}
+    //////////////////////////////////////////////////////////////////////////
+    for (int drive = 0; drive < NR_HD; ++drive) {
+        hd_info[drive].mult = hd_set_multiple(drive);
+        if (hd_info[drive].mult)
+            printk("hd%d: %d sectors per interrupt\n", drive, 
+                   hd_info[drive].mult);
+    }
     //////////////////////////////////////////////////////////////////////////
 	for (int drive = 0; drive < NR_HD; ++drive) {
         // check https://en.wikipedia.org/wiki/Master_boot_record
@@ -324,7 +535,7 @@ repeat:
     //////////////////////////////////////////////////////////////////////////
     dev = MINOR(CURRENT->dev);
     block = CURRENT->sector;
-    if (dev >= 5 * NR_HD || block+2 > hd[dev].nr_sects) {
+    if (dev >= 5 * NR_HD || block + CURRENT->nr_sectors > hd[dev].nr_sects) {
         end_request(0);
         goto repeat;
     }
@@ -368,8 +579,23 @@ repeat:
         return;
     }	
     /***************************************************************/
+    if (setmult & (1 << dev)) {
+        setmult &= ~(1 << dev);
+        if (hd_info[dev].mult) {
+            hd_out(dev, hd_info[dev].mult, 0,0,0, WIN_SETMULT, &setmult_intr);
+            return;
+        }
+    }
+    /***************************************************************/
+    if (hd_dma_base) {
+        hd_dma_start(dev, nsect, sec, head, cyl);
+        return;
+    }
+    /***************************************************************/
+    hd_mult = hd_info[dev].mult ? hd_info[dev].mult : 1;
     if (CURRENT->cmd == WRITE) {
-        hd_out(dev, nsect, sec, head, cyl, WIN_WRITE, &write_intr);
+        hd_out(dev, nsect, sec, head, cyl, 
+               hd_mult > 1 ? WIN_MULTWRITE : WIN_WRITE, &write_intr);
         /*******************************************************/
         int r = 0;
         for(int i = 0; i < 3000; ++i) {
@@ -382,21 +608,24 @@ repeat:
             goto repeat;
         }
         /*******************************************************/
-        port_write(HD_DATA, CURRENT->buffer, 256);  // 256*2 bytes
+        write_block();  // the first block, hd_mult*512 bytes at most
     } 
     else if (CURRENT->cmd == READ)
-        hd_out(dev, nsect, sec, head, cyl, WIN_READ, &read_intr);
+        hd_out(dev, nsect, sec, head, cyl, 
+               hd_mult > 1 ? WIN_MULTREAD : WIN_READ, &read_intr);
     else
         panic("unknown hd-command");
 }
 
-void hd_init(void)
+void hd_init(int dma)
 {
-	blk_dev[MAJOR_NR].request_fn = DEVICE_REQUEST;  // do_hd_request
+    if (dma && (hd_dma_base = hd_dma_probe()))
+        printk("hd: bus-master DMA at port %#x\n", hd_dma_base);
+    blk_dev[MAJOR_NR].request_fn = DEVICE_REQUEST;  // do_hd_request
     /*******************************************************/
-	set_intr_gate(0x2E, &hd_interrupt);
+    set_intr_gate(0x2E, &hd_interrupt);
     /*******************************************************/
-	outb_p(inb_p(0x21)&0xfb, 0x21);
-	outb(inb_p(0xA1)&0xbf, 0xA1);
+    outb_p(inb_p(0x21)&0xfb, 0x21);
+    outb(inb_p(0xA1)&0xbf, 0xA1);
 }
 
@@ -114,6 +114,46 @@ static void add_request(struct blk_dev_struct* dev, struct request* req)
     sti();
 }
 
+/*
+ * Tries to add bh to a queued request for the neighbouring blocks, at its
+ * back or at its front. The request at the head of the queue is left
+ * alone: the driver may already have programmed the controller for it.
+ * Only the hard disk driver knows about multi-buffer requests.
+ * Called with interrupts off.
+ */
+static bool merge_request(int major, int rw, struct buffer_head* bh)
+{
+    if (major != 3) return false;
+    //////////////////////////////////////////////////////////////////////////
+    struct request* req = blk_dev[major].current_request;
+    if (!req) return false;
+    //////////////////////////////////////////////////////////////////////////
+    unsigned long sector = bh->b_blocknr << 1;
+    while ((req = req->next)) {
+        if (req->dev != bh->b_dev || req->cmd != rw || !req->bh) continue;
+        if (req->nr_sectors + 2 > MAX_SECTORS) continue;
+        /***********************************************************/
+        if (req->sector + req->nr_sectors == sector) {  // back merge
+            req->bhtail->b_reqnext = bh;
+            req->bhtail = bh;
+        }
+        else if (req->sector == sector + 2) {           // front merge
+            bh->b_reqnext = req->bh;
+            req->bh = bh;
+            req->buffer = bh->b_data;
+            req->current_nr_sectors = 2;
+            req->sector = sector;
+        }
+        else
+            continue;
+        /***********************************************************/
+        req->nr_sectors += 2;
+        bh->b_dirt = 0;
+        return true;
+    }
+    return false;
+}
+
 static void make_request(int major, int rw, struct buffer_head* bh)
 {
     /* WRITEA/READA is special case - it is not really needed, so if the */
@@ -133,6 +173,13 @@ static void make_request(int major, int rw, struct buffer_head* bh)
         return;
     }
     //////////////////////////////////////////////////////////////////////////
+    cli();
+    if (merge_request(major, rw, bh)) {
+        sti();
+        return;     // the buffer is unlocked when the request ends
+    }
+    sti();
+    //////////////////////////////////////////////////////////////////////////
 repeat:
 /* 
      * we don't allow the write-requests to fill up the queue completely:
@@ -162,9 +209,11 @@ repeat:
     req->errors = 0;
     req->sector = bh->b_blocknr<<1; // 1 block == 2 sectors == 1KB
     req->nr_sectors = 2;
+    req->current_nr_sectors = 2;
     req->buffer = bh->b_data;
     req->waiting = NULL;
     req->bh = bh;
+    req->bhtail = bh;
     //req->next = NULL; // add_request will do this
     add_request(blk_dev + major, req);      // TO-READ
     // The buffer is still locked! Unlock in end_request()
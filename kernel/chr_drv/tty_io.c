@@ -139,7 +139,10 @@ static void tty_intr(struct tty_struct* tty, int mask)
     if (tty->pgrp <= 0) return;
     /***************************************************************/
     for (int i = 0; i < NR_TASKS; ++i)
-        if (task[i] && task[i]->pgrp == tty->pgrp) task[i]->signal |= mask;
+        if (task[i] && task[i]->pgrp == tty->pgrp) {
+            task[i]->signal |= mask;
+            signal_wake_up(task[i]);
+        }
 }
 
 /*
@@ -277,7 +280,7 @@ int tty_read(unsigned channel, char* buf, int nr)
     if (time && !minimum) {
         minimum = 1;
         flag = !oldalarm || (time + jiffies < oldalarm);
-        if (flag) current->alarm = time + jiffies;
+        if (flag) set_alarm(current, time + jiffies);
     }
     /***************************************************************/
     if (minimum > nr) minimum = nr;
@@ -315,13 +318,13 @@ int tty_read(unsigned channel, char* buf, int nr)
         /***************************************************************/
         if (time && !L_CANON(tty)) {
             flag = !oldalarm || (time + jiffies < oldalarm);
-            current->alarm = flag ? time + jiffies : oldalarm;
+            set_alarm(current, flag ? time + jiffies : oldalarm);
         }
         /***************************************************************/
         if ((L_CANON(tty) && b-buf) || b-buf >= minimum) break;
     }
     //////////////////////////////////////////////////////////////////////////
-    current->alarm = oldalarm;
+    set_alarm(current, oldalarm);
     //////////////////////////////////////////////////////////////////////////
     if (current->signal && !(b-buf)) return -EINTR;
     return (b-buf);   // return the nr of bytes read
@@ -20,21 +20,25 @@ void release(struct task_struct* p)
 {
     if (!p) return;
 
-    for (int i = 1; i < NR_TASKS; ++i)
-        if (task[i] == p) {
-            task[i] = NULL;
-            free_page((unsigned long) p);
-            schedule();
-            return;
-        }
+    int nr = _TASK_NR(p);
+    if (nr > 0 && nr < NR_TASKS && task[nr] == p) {
+        task[nr] = NULL;
+        free_task_slot(nr);
+        free_page_dir(p);
+        free_page((unsigned long) p);
+        schedule();
+        return;
+    }
 
     panic("Trying to release non-existent task!");
 }
 
 static inline void fast_release(struct task_struct** p)
 {   // careful, by Henry
+    free_page_dir(*p);
     free_page((unsigned long) *p);
     *p = NULL;
+    free_task_slot(p - task);
     schedule();
     return;
 }
@@ -46,6 +50,7 @@ static inline int send_sig(long sig, struct task_struct* p, int priv)
     if (priv || (current->euid == p->euid) || suser()) 
     {
         p->signal |= (1<<(sig-1));	// send signal
+        signal_wake_up(p);
         return 0;
     }
     
@@ -57,8 +62,10 @@ static void kill_session(void)
     struct task_struct** p = task + NR_TASKS;
 
     while (--p > &FIRST_TASK) {
-        if (*p && (*p)->session == current->session)
+        if (*p && (*p)->session == current->session) {
             (*p)->signal |= 1<<(SIGHUP-1);
+            signal_wake_up(*p);
+        }
     }
 }
 
@@ -102,6 +109,7 @@ static void tell_father(int pid)
         {   // tell father to do some cleanup
             if (!task[i] || task[i]->pid != pid) continue;
             task[i]->signal |= (1<<(SIGCHLD-1));
+            signal_wake_up(task[i]);
             return;
         }
     /* if we don't find any fathers, we just release ourselves */
@@ -112,6 +120,7 @@ static void tell_father(int pid)
 
 volatile int do_exit(long code)
 {
+    exit_mmap();
     free_page_tables(get_base(current->ldt[1]), get_limit(0x0f));
     free_page_tables(get_base(current->ldt[2]), get_limit(0x17));
     ////////////////////////////////////////////////////  
@@ -134,6 +143,7 @@ volatile int do_exit(long code)
     current->root = NULL;
     iput(current->executable);
     current->executable = NULL;
+    set_alarm(current, 0);
     ///////////////////////////////////////////////////
     if (current->leader && current->tty >= 0) tty_table[current->tty].pgrp = 0;
     if (last_task_used_math == current) last_task_used_math = NULL;
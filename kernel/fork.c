@@ -22,6 +22,13 @@ extern void write_verify(unsigned long address);
 
 static int last_pid = 0;
 
+/*
+ * Unused task slots, as a stack, so find_empty_process() doesn't have to
+ * scan task[]. Slot 0 is never on it. sched_init() fills it.
+ */
+static int free_slots[NR_TASKS];
+static int nr_free_slots = 0;
+
 static int copy_mem(int nr, struct task_struct* p)
 {
 	unsigned long old_data_base, new_data_base, data_limit;
@@ -37,15 +44,15 @@ static int copy_mem(int nr, struct task_struct* p)
 	if (data_limit < code_limit)	            // obvious data > code
 		panic("Bad data_limit");
     /***************************************************************/
-	new_data_base = new_code_base = nr * 0x4000000;	 // nr * 64MB 
+	new_data_base = new_code_base = TASK_BASE(nr);
 	p->start_code = new_code_base;
     set_base(p->ldt[1], new_code_base);
     set_base(p->ldt[2], new_data_base);
     /***************************************************************/
-    if (copy_page_tables(old_data_base, new_data_base, data_limit)) 
+    if (!(p->tss.cr3 = new_page_dir())) return -ENOMEM;
+    if (copy_page_tables(old_data_base, new_data_base, data_limit, p)) 
     {
-        printk("free_page_tables: from copy_mem\n");
-        free_page_tables(new_data_base, data_limit);
+        free_page_dir(p);
         return -ENOMEM;
     }
     return 0;
@@ -80,10 +87,14 @@ int copy_process(int nr, long ebp, long edi, long esi, long gs, long none,
                  long eip, long cs, long eflags, long esp, long ss)
 {
 	struct task_struct* p = (struct task_struct *) get_free_page();
-	if (!p) return -EAGAIN;
+	if (!p) {
+        free_task_slot(nr);
+        return -EAGAIN;
+    }
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
-	task[nr] = p;
 	*p = *current; //* NOTE! this doesn't copy the supervisor stack */
+	p->tss.cr3 = 0;     // no directory till copy_mem(): swap_out() skips p
+	task[nr] = p;
     //////////////////////////////////////////////////////////////////////////
     p->state = TASK_UNINTERRUPTIBLE;
 	p->pid = last_pid;
@@ -91,6 +102,8 @@ int copy_process(int nr, long ebp, long edi, long esi, long gs, long none,
 	p->counter = p->priority;
 	p->signal = 0;
 	p->alarm = 0;
+	p->next_alarm = NULL;
+	p->array = NULL;        // not on any run queue yet
 	p->leader = 0;		/* process leadership doesn't inherit */
 	p->utime = p->stime = 0;
 	p->cutime = p->cstime = 0;
@@ -126,9 +139,11 @@ int copy_process(int nr, long ebp, long edi, long esi, long gs, long none,
     //////////////////////////////////////////////////////////////////////////
     if (copy_mem(nr, p)) {
         task[nr] = NULL;	    // fork fail :-(
+        free_task_slot(nr);
         free_page((long) p);    // then free task struct
         return -EAGAIN;
     }
+    copy_mmap(p);
     //////////////////////////////////////////////////////////////////////////
 	for (int i = 0; i < NR_OPEN; ++i) {
         struct file* f = p->filp[i];
@@ -141,32 +156,52 @@ int copy_process(int nr, long ebp, long edi, long esi, long gs, long none,
     //////////////////////////////////////////////////////////////////////////
 	set_tss_desc(nr, &(p->tss));
 	set_ldt_desc(nr, &(p->ldt));
-	p->state = TASK_RUNNING;	/* do this last, just in case */
+	wake_up_process(p);	/* do this last, just in case */
     //////////////////////////////////////////////////////////////////////////
 	return p->pid;	 // the return of the sys_fork
 }
 
-int find_empty_process(void)
+/*
+ * Picks the next unused pid into last_pid. No task has a pid in
+ * (last_pid, next_safe), so task[] is only scanned again once last_pid
+ * reaches next_safe - and that scan finds the next such range.
+ */
+static void get_pid(void)
 {
-	register int i;
-    /////////////////////////////////////////////////////////////////
-    // find an unused id for new process
-    // since ++last_pid can make last_pid overflow, it's neccessary to enusre
-    // (++last_pid)>0.
-    i = 0;
-    if ((++last_pid) < 0) last_pid = 1; 
-    while (i < NR_TASKS) {
-        if (task[i] && task[i]->pid == last_pid) {
-            i = 0;
-            if ((++last_pid) < 0) last_pid = 1; 
-            continue;
+    static int next_safe = 0;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    // ++last_pid can overflow: keep it > 0
+    if ((++last_pid) < 0) last_pid = next_safe = 1;
+    if (last_pid < next_safe) return;
+    //////////////////////////////////////////////////////////////////////////
+repeat:
+    next_safe = 0x7fffffff;
+    for (int i = 0; i < NR_TASKS; ++i) {
+        struct task_struct* p = task[i];
+        if (!p) continue;
+        if (p->pid == last_pid) {
+            if ((++last_pid) < 0) last_pid = 1;
+            goto repeat;
         }
-        ++i;
+        if (p->pid > last_pid && p->pid < next_safe) next_safe = p->pid;
     }
-    ////////////////////////////////////////////////////////////////        
-    for (i = 1; i < NR_TASKS; ++i)  /* find an empty slot for new process */
-        if (!task[i]) return i;    
-    ////////////////////////////////////////////////////////////////        
-    return -EAGAIN;
+}
+
+int find_empty_process(void)
+{
+    /* take an empty slot for new process: copy_process() fills it */
+    if (!nr_free_slots) return -EAGAIN;
+    get_pid();
+    return free_slots[--nr_free_slots];
+}
+
+// give slot nr back, once task[nr] is NULL again
+void free_task_slot(int nr)
+{
+    if (nr <= 0 || nr >= NR_TASKS || task[nr])
+        panic("free_task_slot: bad slot");
+    if (nr_free_slots >= NR_TASKS - 1)
+        panic("free_task_slot: slot freed twice");
+    free_slots[nr_free_slots++] = nr;
 }
 
@@ -39,6 +39,7 @@ void show_stat(void)
 	for (int i=0; i < NR_TASKS; i++)
 		if (task[i])
 			show_task(i,task[i]);
+	show_buffer_stat();
 }
 
 // LATCH := 1193180 / 100: the timer frequency is 100 Hz
@@ -94,6 +95,83 @@ void math_state_restore()
 	}
 }
 
+/*
+ * The run queues. Every runnable task except 'current' and task 0 sits on
+ * exactly one of them. 'active' is indexed by the task's counter, so the
+ * task with the largest counter is found with a single bsrl over the
+ * bitmap. 'expired' holds the tasks that used up their time-slice, indexed
+ * by priority, which is what their counter becomes at the next
+ * recalculation. When 'active' runs dry the two are swapped, and the
+ * epoch is bumped instead of walking the task table: each task catches up
+ * on the recalculations it missed when it is next queued or picked (see
+ * update_counter()). That includes sleepers, which is what gives I/O-bound
+ * tasks their boost, as before.
+ */
+#define NR_PRIO 32
+
+struct prio_array {
+    unsigned long bitmap;               /* bit n set: queue[n] non-empty */
+    struct task_struct* queue[NR_PRIO]; /* circular lists, FIFO */
+};
+
+static struct prio_array prio_arrays[2] = {};
+static struct prio_array* active = prio_arrays;
+static struct prio_array* expired = prio_arrays + 1;
+static unsigned long sched_epoch = 0;
+
+// counter = counter/2 + priority, once per epoch missed. After 32 rounds
+// nothing of the old counter is left, so there's no need to go further.
+static inline void update_counter(struct task_struct* p)
+{
+    unsigned long n = sched_epoch - p->epoch;
+    if (n > 32) n = 32;
+    while (n--) p->counter = (p->counter >> 1) + p->priority;
+    p->epoch = sched_epoch;
+}
+
+// interrupts must be off
+static void enqueue_task(struct task_struct* p)
+{
+    if (p->array) return;   // already queued
+    /***************************************************************/
+    update_counter(p);
+    struct prio_array* array = p->counter ? active : expired;
+    long level = p->counter ? p->counter : p->priority;
+    if (level >= NR_PRIO) level = NR_PRIO - 1;
+    /***************************************************************/
+    struct task_struct** head = array->queue + level;
+    if (*head) {    // put at the tail
+        p->next_run = *head;
+        p->prev_run = (*head)->prev_run;
+        (*head)->prev_run->next_run = p;
+        (*head)->prev_run = p;
+    } 
+    else {
+        *head = p->next_run = p->prev_run = p;
+        array->bitmap |= 1UL << level;
+    }
+    p->array = array;
+    p->rq_level = level;
+}
+
+// interrupts must be off
+static void dequeue_task(struct task_struct* p)
+{
+    struct task_struct** head = p->array->queue + p->rq_level;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    if (p->next_run == p) {
+        *head = NULL;
+        p->array->bitmap &= ~(1UL << p->rq_level);
+    } 
+    else {
+        p->prev_run->next_run = p->next_run;
+        p->next_run->prev_run = p->prev_run;
+        if (*head == p) *head = p->next_run;
+    }
+    p->next_run = p->prev_run = NULL;
+    p->array = NULL;
+}
+
 /*
  *  'schedule()' is the scheduler function. This is GOOD CODE! There
  * probably won't be any reason to change this, as it should work well
@@ -103,58 +181,86 @@ void math_state_restore()
  *   NOTE!!  Task 0 is the 'idle' task, which gets called when no other
  * tasks can run. It can not be killed, and it cannot sleep. The 'state'
  * information in task[0] is never used.
+ *
+ * Alarms and signals are no longer checked here: see do_timer() and
+ * signal_wake_up(). Picking the next task costs the same however many
+ * tasks there are.
  */
 void schedule(void)
 {
-	struct task_struct** p;
-/* check alarm, wake up any interruptible tasks that have got a signal */
-    for (p = &LAST_TASK; p > &FIRST_TASK; --p)
-        if (*p) {
-            if ((*p)->alarm && (*p)->alarm < jiffies) 
-            {
-                (*p)->signal |= (1<<(SIGALRM-1));
-                (*p)->alarm = 0;
-            }
-            // p has signals that are not blocked
-            if (((*p)->signal & ~(_BLOCKABLE & (*p)->blocked)) 
-                && (*p)->state == TASK_INTERRUPTIBLE)
-            {
-                (*p)->state = TASK_RUNNING;
-            }
-        }
+    unsigned long flags;
+    save_flags(flags);
+    cli();
+    //////////////////////////////////////////////////////////////////////////
+    /* a signal may have come in before current went to sleep */
+    if (current->state == TASK_INTERRUPTIBLE &&
+        (current->signal & ~(_BLOCKABLE & current->blocked)))
+        current->state = TASK_RUNNING;
+    /* put current back, unless it's going to sleep (or die) */
+    if (current->array) dequeue_task(current);
+    if (current != &(init_task.task) && current->state == TASK_RUNNING)
+        enqueue_task(current);
+    //////////////////////////////////////////////////////////////////////////
+    /* all counters are 0: recalculate them (lazily) */
+    if (!active->bitmap && expired->bitmap) {
+        struct prio_array* tmp = active;
+        active = expired;
+        expired = tmp;
+        ++sched_epoch;
+    }
+    //////////////////////////////////////////////////////////////////////////
     /* this is the scheduler proper: */
-    int next = 0;
-    do {
-        int c = -1;                 
-        int i = NR_TASKS;
-        p = task + NR_TASKS;    // the ghost task
-
-        while (--i) {   // i in [NR_TASKS..1], task[0] will never be touched
-            if (!*--p) continue;
-            // get the task with the largest counter :-)
-            if ((*p)->state == TASK_RUNNING && (*p)->counter > c) 
-                c = (*p)->counter, next = i;
-        }
-        if (c) break; // if the largest counter is larger than 0 then break
-                      // otherwise reset counters of all tasks  
-        for(p = &LAST_TASK; p > &FIRST_TASK; --p) 
-            if (*p) (*p)->counter = ((*p)->counter >> 1) + (*p)->priority;
-    } while (true);
+    struct task_struct* next = &(init_task.task);
+    if (active->bitmap) {
+        long level;
+        __asm__ ("bsrl %1, %0" : "=r" (level) : "rm" (active->bitmap));
+        next = active->queue[level];
+        dequeue_task(next);
+        update_counter(next);
+    }
 #undef DEBUG
 #ifdef DEBUG
     printkc("Current Pid: %d\n",current->pid);
-    printkc("Next Pid: %d\n",task[next]->pid);
+    printkc("Next Pid: %d\n",next->pid);
 #endif
-	switch_to(next);
+	switch_to(_TASK_NR(next));
+    restore_flags(flags);
 }
 
 int sys_pause(void)
 {
+	// task 0 only pauses when there's nothing else to do: use the time
+	if (current == task[0]) refill_zero_pages();
 	current->state = TASK_INTERRUPTIBLE;
 	schedule();
 	return 0;
 }
 
+/*
+ * Make a sleeping task runnable and queue it. Tasks that are already
+ * running, stopped or dead are left alone.
+ */
+void wake_up_process(struct task_struct* p)
+{
+    unsigned long flags;
+    save_flags(flags);
+    cli();
+    if (p->state == TASK_INTERRUPTIBLE || p->state == TASK_UNINTERRUPTIBLE) {
+        p->state = TASK_RUNNING;
+        // current gets queued by schedule() itself
+        if (p != current) enqueue_task(p);
+    }
+    restore_flags(flags);
+}
+
+// to be called after setting a bit in p->signal
+void signal_wake_up(struct task_struct* p)
+{
+    if (p->state == TASK_INTERRUPTIBLE &&
+        (p->signal & ~(_BLOCKABLE & p->blocked)))
+        wake_up_process(p);
+}
+
 // Question: If one of the sleeping is killed, the tasks following
 // that dead one will never be awakened, right?
 void sleep_on(struct task_struct** p) // sleep on the double pointer p
@@ -168,7 +274,7 @@ void sleep_on(struct task_struct** p) // sleep on the double pointer p
 	schedule();
     /***************************************************************/
     // wakes all the asleep tasks
-	if (tmp) tmp->state = TASK_RUNNING;
+	if (tmp) wake_up_process(tmp);
 }
 
 void interruptible_sleep_on(struct task_struct** p)
@@ -182,13 +288,13 @@ void interruptible_sleep_on(struct task_struct** p)
     schedule();
     wake_up(p); // wakes all the asleep tasks
     /***************************************************************/
-	if (tmp) tmp->state = TASK_RUNNING;
+	if (tmp) wake_up_process(tmp);
 }
 
 inline void wake_up(struct task_struct** p)
 {
 	if (p && *p) {
-        (*p)->state = TASK_RUNNING;     
+        wake_up_process(*p);
         *p = NULL;
 	}
 }
@@ -306,6 +412,40 @@ void add_timer(long jiffies, void (*fn)(void))
     sti();
 }
 
+/*
+ * Tasks with an alarm pending, soonest first. do_timer() only ever looks
+ * at the head, so expiry costs nothing while no alarm is due.
+ */
+static struct task_struct* alarm_list = NULL;
+
+// set (when > 0) or cancel (when == 0) the alarm of p
+void set_alarm(struct task_struct* p, long when)
+{
+    unsigned long flags;
+    save_flags(flags);
+    cli();
+    //////////////////////////////////////////////////////////////////////////
+    struct task_struct** tmp;
+    if (p->alarm) {     // on the list: unlink it first
+        for (tmp = &alarm_list; *tmp; tmp = &(*tmp)->next_alarm)
+            if (*tmp == p) {
+                *tmp = p->next_alarm;
+                break;
+            }
+    }
+    /***************************************************************/
+    p->next_alarm = NULL;
+    p->alarm = when;
+    if (when) {
+        for (tmp = &alarm_list; *tmp; tmp = &(*tmp)->next_alarm)
+            if ((*tmp)->alarm > when) break;
+        p->next_alarm = *tmp;
+        *tmp = p;
+    }
+    //////////////////////////////////////////////////////////////////////////
+    restore_flags(flags);
+}
+
 void do_timer(long cpl)
 {
 	extern int beepcount;
@@ -324,6 +464,16 @@ void do_timer(long cpl)
             (fn)();
         }
     }
+    /***************************************************************/
+    /* check alarm, wake up the task if it's interruptible */
+    while (alarm_list && alarm_list->alarm < jiffies) {
+        struct task_struct* p = alarm_list;
+        alarm_list = p->next_alarm;
+        p->next_alarm = NULL;
+        p->alarm = 0;
+        p->signal |= (1<<(SIGALRM-1));
+        signal_wake_up(p);
+    }
     /***************************************************************/
 	if (current_DOR & 0xf0) do_floppy_timer();
     /***************************************************************/
@@ -344,7 +494,7 @@ int sys_alarm(int seconds)
     int old = current->alarm;
     if (old) old = (old - jiffies) / HZ;
 
-    current->alarm = (seconds > 0) ? (jiffies + HZ*seconds) : 0;
+    set_alarm(current, (seconds > 0) ? (jiffies + HZ*seconds) : 0);
     return old;
 }
 
@@ -403,6 +553,9 @@ void sched_init(void)
 		p->a = p->b = 0; // ldt_i
 		p++;
 	}
+    /* downwards, so that the first fork() gets slot 1 (init) */
+	for (int i = NR_TASKS - 1; i > 0; --i)
+		free_task_slot(i);
     //////////////////////////////////////////////////////////////////////////
     ///
     /* Clear NT(nested task), so that we won't have troubles with 
@@ -168,11 +168,29 @@ int sys_times(struct tms* tbuf)
     return jiffies;
 }
 
-int sys_brk(unsigned long end_data_seg) // heap area?
-{
-    if (end_data_seg >= current->end_code &&
-        end_data_seg < current->start_stack - 16384)
-        current->brk = end_data_seg;
+/*
+ * Moves the end of the heap, within RLIMIT_DATA and STACK_GUARD short of
+ * where the stack may reach (see sched.h) and of any file mapping. Pages
+ * given back are unmapped right away. Returns the new brk, the old one if
+ * the request is refused.
+ */
+int sys_brk(unsigned long end_data_seg)
+{
+    if (end_data_seg < current->end_code) return current->brk;
+    if (end_data_seg - current->end_code > 
+        current->rlim[RLIMIT_DATA].rlim_cur) 
+        return current->brk;
+    //////////////////////////////////////////////////////////////////////////
+    unsigned long stack = STACK_BOTTOM(current);
+    if (!stack || stack > current->start_stack) stack = current->start_stack;
+    if (PAGE_ALIGN(end_data_seg) + STACK_GUARD > stack) return current->brk;
+    if (find_mmap(current, 0, PAGE_ALIGN(end_data_seg) + STACK_GUARD)) 
+        return current->brk;
+    //////////////////////////////////////////////////////////////////////////
+    unsigned long old = PAGE_ALIGN(current->brk);
+    unsigned long new = PAGE_ALIGN(end_data_seg);
+    if (new < old) unmap_page_range(current->start_code + new, old - new);
+    current->brk = end_data_seg;
     return current->brk;
 }
 
@@ -240,14 +258,33 @@ int sys_sethostname(char *name, int len)
     return -ENOSYS;
 }
 
-int sys_getrlimit()
+int sys_getrlimit(int resource, struct rlimit* rlim)
 {
-    return -ENOSYS;
+    if (resource < 0 || resource >= RLIM_NLIMITS) return -EINVAL;
+
+    copy_to_user(current->rlim + resource, rlim, struct rlimit);
+    return 0;
 }
 
-int sys_setrlimit()
+/*
+ * Anybody may lower a limit; only the superuser may raise rlim_max.
+ * Limits already exceeded take effect at the next page fault or brk.
+ */
+int sys_setrlimit(int resource, struct rlimit* rlim)
 {
-    return -ENOSYS;
+    struct rlimit new;
+
+    if (resource < 0 || resource >= RLIM_NLIMITS) return -EINVAL;
+
+    new.rlim_cur = get_fs_long((unsigned long*) rlim);
+    new.rlim_max = get_fs_long((unsigned long*) rlim + 1);
+    if (new.rlim_cur < 0 || new.rlim_max < 0) return -EINVAL;
+    if (new.rlim_cur > new.rlim_max) return -EINVAL;
+    if (new.rlim_max > current->rlim[resource].rlim_max && !suser()) 
+        return -EPERM;
+
+    current->rlim[resource] = new;
+    return 0;
 }
 
 /*
@@ -307,11 +344,6 @@ int sys_uselib()
     return -ENOSYS;
 }
 
-int sys_swapon()
-{
-    return -ENOSYS;
-}
-
 int sys_reboot()
 {
     return -ENOSYS;
@@ -1,6 +1,6 @@
 /*
  * malloc.c --- a general purpose kernel memory allocator for Linux.
- * 
+ *
  * Written by Theodore Ts'o (tytso@mit.edu), 11/29/91
  *
  * This routine is written to be as fast as possible, so that it
@@ -9,224 +9,392 @@
  * Limitations: maximum size of memory we can allocate using this routine
  *	is 4k, the size of a page in Linux.
  *
- * The general game plan is that each page (called a bucket) will only hold
- * objects of a given size.  When all of the object on a page are released,
- * the page can be returned to the general free pool.  When malloc() is
- * called, it looks for the smallest bucket size which will fulfill its
- * request, and allocate a piece of memory from that bucket pool.
+ * Now a slab allocator. Memory is handed out by object caches: each
+ * cache serves objects of one size, from pages of its own called slabs.
+ * A slab starts with its descriptor (struct slab), then one free-list
+ * index per object (bufctl), then the objects. Keeping the free list
+ * out of the objects lets a cache with a constructor construct them once,
+ * when the slab is got, and hand them out again as they were freed.
+ * Objects of OFF_SLAB bytes and up would leave most of a page to waste
+ * that way: their descriptor comes from slab_cache instead, and the page
+ * holds nothing but objects.
  *
- * Each bucket has as its control block a bucket descriptor which keeps 
- * track of how many objects are in use on that page, and the free list
- * for that page.  Like the buckets themselves, bucket descriptors are
- * stored on pages requested from get_free_page().  However, unlike buckets,
- * pages devoted to bucket descriptor pages are never released back to the
- * system.  Fortunately, a system should probably only need 1 or 2 bucket
- * descriptor pages, since a page can hold 256 bucket descriptors (which
- * corresponds to 1 megabyte worth of bucket pages.)  If the kernel is using 
- * that much allocated memory, it's probably doing something wrong.  :-)
+ * Finding the slab of an object is masking its address, or for those
+ * kept off the slab a look in off_slab_hash, so free_s() no longer
+ * searches. A cache keeps its slabs on three lists, partial, full
+ * and empty, and allocates from the partial ones first. It keeps at most
+ * one empty slab; further ones go back to get_free_page() at once.
  *
- * Note: malloc() and free() both call get_free_page() and free_page()
- *	in sections of code where interrupts are turned off, to allow
- *	malloc() and free() to be safely called from an interrupt routine.
- *	(We will probably need this functionality when networking code,
- *	particularily things like NFS, is added to Linux.)  However, this
- *	presumes that get_free_page() and free_page() are interrupt-level
- *	safe, which they may not be once paging is added.  If this is the
- *	case, we will need to modify malloc() to keep a few unused pages
- *	"pre-allocated" so that it can safely draw upon those pages if
- * 	it is called from an interrupt routine.
+ * malloc() and free_s() are on top of the size caches, 16 to 2048 bytes.
+ * Bigger requests get a page of their own: free_s() tells them apart as
+ * page aligned and not in off_slab_hash.
  *
- * 	Another concern is that get_free_page() should not sleep; if it 
- *	does, the code is carefully ordered so as to avoid any race 
- *	conditions.  The catch is that if malloc() is called re-entrantly, 
- *	there is a chance that unecessary pages will be grabbed from the 
- *	system.  Except for the pages for the bucket descriptor page, the 
- *	extra pages will eventually get released back to the system, though,
- *	so it isn't all that bad.
+ * Caches are touched with interrupts off, so all of this can be used from
+ * interrupt routines. get_free_page() is called with interrupts back on
+ * if they were on: then it may sleep (to swap), and the lists are looked
+ * at again afterwards.
  */
 
+#include <stddef.h>
+
 #include <linux/kernel.h>
 #include <linux/mm.h>
+#include <linux/slab.h>
 #include <asm/system.h>
 
-struct bucket_desc {	/* 16 bytes */
-	void			*page;
-	struct bucket_desc	*next;
-	void			*freeptr;
-	unsigned short		refcnt;
-	unsigned short		bucket_size;
+#define SLAB_END 0xffff     /* bufctl: no next free object */
+#define SLAB_ALIGN 8
+#define OFF_SLAB 512        /* objects this big keep the descriptor off */
+#define OFF_SLAB_HASH 64
+
+struct slab {
+	struct kmem_cache	*cache;
+	struct slab		*prev, *next;	/* on the cache's list */
+	char			*mem;		/* the first object */
+	struct slab		*hash_next;	/* in off_slab_hash */
+	unsigned short		inuse;		/* objects handed out */
+	unsigned short		free;		/* first free object */
+	unsigned short		bufctl[];	/* next free object, per object */
 };
 
-struct _bucket_dir {	/* 8 bytes */
-	int			size;
-	struct bucket_desc	*chain;
+struct kmem_cache {
+	const char		*name;
+	unsigned int		size;		/* object size, aligned */
+	void			(*ctor)(void *);
+	unsigned short		num;		/* objects per slab, 0: not set up */
+	unsigned short		offset;		/* of the first object */
+	unsigned char		off_slab;	/* descriptor from slab_cache */
+	struct slab		*partial, *full, *empty;
+	struct kmem_cache	*next;		/* on cache_chain */
+	/* statistics */
+	unsigned long		allocs, frees;
+	unsigned long		grown, reaped;	/* slab pages got, given back */
+	unsigned long		slabs;		/* slab pages now */
 };
 
+#define slab_of(obj) ((struct slab *) ((unsigned long) (obj) & 0xfffff000))
+#define slab_obj(c, s, i) ((s)->mem + (i) * (c)->size)
+#define off_slab_hashfn(page) (((page) >> 12) & (OFF_SLAB_HASH - 1))
+
+/* descriptors kept off the slab, and the slabs they are for by page */
+static struct kmem_cache slab_cache = { "slab", sizeof(struct slab) +
+	PAGE_SIZE / OFF_SLAB * sizeof(unsigned short) };
+static struct slab *off_slab_hash[OFF_SLAB_HASH];
+
+/* the cache of caches, and the size caches behind malloc() */
+static struct kmem_cache cache_cache =
+	{ "kmem_cache", sizeof(struct kmem_cache), .next = &slab_cache };
+
+static struct kmem_cache size_caches[] = {
+	{ "size-16",	16 },
+	{ "size-32",	32 },
+	{ "size-64",	64 },
+	{ "size-128",	128 },
+	{ "size-256",	256 },
+	{ "size-512",	512 },
+	{ "size-1024",	1024 },
+	{ "size-2048",	2048 },
+	{ NULL,		0 }};   /* End of list marker */
+
+static struct kmem_cache *cache_chain = &cache_cache;
+
 /*
- * The following is the where we store a pointer to the first bucket
- * descriptor for a given size.  
- *
- * If it turns out that the Linux kernel allocates a lot of objects of a
- * specific size, then we may want to add that specific size to this list,
- * since that will allow the memory to be allocated more efficiently.
- * However, since an entire page must be dedicated to each specific size
- * on this list, some amount of temperance must be exercised here.
- *
- * Note that this list *must* be kept in order.
+ * Works out how many objects fit in a slab, with their bufctl entries.
+ */
+static void cache_layout(struct kmem_cache *c)
+{
+	unsigned int num, offset;
+
+	c->size = (c->size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+	if (c->size >= OFF_SLAB) {
+		c->off_slab = 1;
+		c->offset = 0;
+		c->num = PAGE_SIZE / c->size;
+		return;
+	}
+	num = (PAGE_SIZE - sizeof(struct slab)) /
+	      (c->size + sizeof(unsigned short));
+	for (;; --num) {
+		offset = sizeof(struct slab) + num * sizeof(unsigned short);
+		offset = (offset + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+		if (offset + num * c->size <= PAGE_SIZE)
+			break;
+	}
+	if (!num)
+		panic("kmem_cache: object too large for a slab");
+	c->offset = offset;
+	c->num = num;
+}
+
+static inline void slab_unlink(struct slab **head, struct slab *s)
+{
+	if (s->prev)
+		s->prev->next = s->next;
+	else
+		*head = s->next;
+	if (s->next)
+		s->next->prev = s->prev;
+}
+
+static inline void slab_link(struct slab **head, struct slab *s)
+{
+	s->prev = NULL;
+	s->next = *head;
+	if (*head)
+		(*head)->prev = s;
+	*head = s;
+}
+
+/* the off-slab slab whose objects are on the page of obj; interrupts off */
+static struct slab *off_slab_find(void *obj)
+{
+	unsigned long page = (unsigned long) obj & 0xfffff000;
+	struct slab *s = off_slab_hash[off_slab_hashfn(page)];
+
+	while (s && (unsigned long) s->mem != page)
+		s = s->hash_next;
+	return s;
+}
+
+/* the slab of obj, from cache c; interrupts off */
+static struct slab *find_slab(struct kmem_cache *c, void *obj)
+{
+	return c->off_slab ? off_slab_find(obj) : slab_of(obj);
+}
+
+/* gives back the page of slab s, and its descriptor; interrupts off */
+static void slab_destroy(struct kmem_cache *c, struct slab *s)
+{
+	struct slab **p;
+
+	if (!c->off_slab) {
+		free_page((unsigned long) s);
+		return;
+	}
+	p = &off_slab_hash[off_slab_hashfn((unsigned long) s->mem)];
+	while (*p != s)
+		p = &(*p)->hash_next;
+	*p = s->hash_next;
+	free_page((unsigned long) s->mem);
+	kmem_cache_free(&slab_cache, s);
+}
+
+/*
+ * Gets a page and makes it an empty slab of c. Called with interrupts as
+ * the caller had them: the page is set up before anybody can see it. An
+ * off-slab one still has to go into off_slab_hash.
  */
-struct _bucket_dir bucket_dir[] = {
-	{ 16,	(struct bucket_desc *) 0},
-	{ 32,	(struct bucket_desc *) 0},
-	{ 64,	(struct bucket_desc *) 0},
-	{ 128,	(struct bucket_desc *) 0},
-	{ 256,	(struct bucket_desc *) 0},
-	{ 512,	(struct bucket_desc *) 0},
-	{ 1024,	(struct bucket_desc *) 0},
-	{ 2048, (struct bucket_desc *) 0},
-	{ 4096, (struct bucket_desc *) 0},
-	{ 0,    (struct bucket_desc *) 0}};   /* End of list marker */
+static struct slab *cache_grow(struct kmem_cache *c)
+{
+	struct slab *s;
+	int i;
+
+	if (!c->off_slab) {
+		if (!(s = (struct slab *) get_free_page()))
+			return NULL;
+		s->mem = (char *) s + c->offset;
+	} else {
+		if (!(s = (struct slab *) kmem_cache_alloc(&slab_cache)))
+			return NULL;
+		if (!(s->mem = (char *) get_free_page())) {
+			kmem_cache_free(&slab_cache, s);
+			return NULL;
+		}
+	}
+	s->cache = c;
+	s->inuse = 0;
+	s->free = 0;
+	for (i = 0; i < c->num; i++)
+		s->bufctl[i] = i + 1;
+	s->bufctl[c->num - 1] = SLAB_END;
+	if (c->ctor)
+		for (i = 0; i < c->num; i++)
+			c->ctor(slab_obj(c, s, i));
+	return s;
+}
 
 /*
- * This contains a linked list of free bucket descriptor blocks
+ **************************** INTERFACE **************************************
  */
-struct bucket_desc *free_bucket_desc = (struct bucket_desc *) 0;
+
+struct kmem_cache *kmem_cache_create(const char *name, unsigned int size,
+				     void (*ctor)(void *))
+{
+	struct kmem_cache *c;
+	unsigned long flags;
+
+	if (!size || size > PAGE_SIZE/2)
+		return NULL;
+	c = (struct kmem_cache *) kmem_cache_alloc(&cache_cache);
+	if (!c)
+		return NULL;
+	*c = (struct kmem_cache) { name, size, ctor };
+	cache_layout(c);
+	save_flags(flags);
+	cli();
+	c->next = cache_chain;
+	cache_chain = c;
+	restore_flags(flags);
+	return c;
+}
 
 /*
- * This routine initializes a bucket description page.
+ * Gives back the empty slabs and the cache itself. Fails (-1) if the
+ * cache still has objects out.
  */
-static inline void init_bucket_desc()
+int kmem_cache_destroy(struct kmem_cache *c)
 {
-	struct bucket_desc *bdesc, *first;
-	int	i;
-	
-	first = bdesc = (struct bucket_desc *) get_free_page();
-	if (!bdesc)
-		panic("Out of memory in init_bucket_desc()");
-	for (i = PAGE_SIZE/sizeof(struct bucket_desc); i > 1; i--) {
-		bdesc->next = bdesc+1;
-		bdesc++;
+	struct kmem_cache **p;
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	if (c->partial || c->full) {
+		restore_flags(flags);
+		return -1;
+	}
+	for (p = &cache_chain; *p && *p != c; p = &(*p)->next)
+		/* nothing */ ;
+	if (*p)
+		*p = c->next;
+	while (c->empty) {
+		struct slab *s = c->empty;
+		slab_unlink(&c->empty, s);
+		slab_destroy(c, s);
 	}
-	/*
-	 * This is done last, to avoid race conditions in case 
-	 * get_free_page() sleeps and this routine gets called again....
-	 */
-	bdesc->next = free_bucket_desc;
-	free_bucket_desc = first;
+	restore_flags(flags);
+	kmem_cache_free(&cache_cache, c);
+	return 0;
 }
 
-void *malloc(unsigned int len)
+void *kmem_cache_alloc(struct kmem_cache *c)
 {
-	struct _bucket_dir	*bdir;
-	struct bucket_desc	*bdesc;
-	void			*retval;
-
-	/*
-	 * First we search the bucket_dir to find the right bucket change
-	 * for this request.
-	 */
-	for (bdir = bucket_dir; bdir->size; bdir++)
-		if (bdir->size >= len)
+	struct slab *s;
+	unsigned long flags;
+	void *obj;
+
+	if (!c->num)
+		cache_layout(c);
+	save_flags(flags);
+	cli();
+	while (!(s = c->partial)) {
+		if ((s = c->empty)) {
+			slab_unlink(&c->empty, s);
+			slab_link(&c->partial, s);
 			break;
-	if (!bdir->size) {
-		printk("malloc called with impossibly large argument (%d)\n",
-			len);
-		panic("malloc: bad arg");
+		}
+		restore_flags(flags);
+		if (!(s = cache_grow(c)))
+			return NULL;
+		cli();
+		c->grown++;
+		c->slabs++;
+		if (c->off_slab) {
+			struct slab **head = &off_slab_hash[
+				off_slab_hashfn((unsigned long) s->mem)];
+			s->hash_next = *head;
+			*head = s;
+		}
+		slab_link(&c->empty, s);	/* and look again */
+	}
+	obj = slab_obj(c, s, s->free);
+	s->free = s->bufctl[s->free];
+	if (++s->inuse == c->num) {
+		slab_unlink(&c->partial, s);
+		slab_link(&c->full, s);
+	}
+	c->allocs++;
+	restore_flags(flags);
+	return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+	struct slab *s;
+	unsigned long flags;
+	int i;
+
+	save_flags(flags);
+	cli();
+	s = find_slab(c, obj);
+	if (!s || s->cache != c)
+		panic("kmem_cache_free: object not from this cache");
+	i = ((char *) obj - slab_obj(c, s, 0)) / c->size;
+	s->bufctl[i] = s->free;
+	s->free = i;
+	c->frees++;
+	if (s->inuse-- == c->num) {
+		slab_unlink(&c->full, s);
+		slab_link(&c->partial, s);
+	}
+	if (!s->inuse) {
+		slab_unlink(&c->partial, s);
+		if (c->empty) {			/* one spare is enough */
+			c->reaped++;
+			c->slabs--;
+			slab_destroy(c, s);
+		} else
+			slab_link(&c->empty, s);
 	}
-	/*
-	 * Now we search for a bucket descriptor which has free space
-	 */
-	cli();	/* Avoid race conditions */
-	for (bdesc = bdir->chain; bdesc; bdesc = bdesc->next) 
-		if (bdesc->freeptr)
+	restore_flags(flags);
+}
+
+void kmem_cache_stats(void)
+{
+	struct kmem_cache *c;
+
+	printk("cache         size  active/total  slabs  grown reaped\n\r");
+	for (c = cache_chain; c; c = c->next)
+		printk("%-12s %5d %7d/%-6d %5d %6d %6d\n\r", c->name, c->size,
+		       c->allocs - c->frees, c->slabs * c->num, c->slabs,
+		       c->grown, c->reaped);
+	for (c = size_caches; c->name; c++)
+		printk("%-12s %5d %7d/%-6d %5d %6d %6d\n\r", c->name, c->size,
+		       c->allocs - c->frees, c->slabs * c->num, c->slabs,
+		       c->grown, c->reaped);
+}
+
+void *malloc(unsigned int len)
+{
+	struct kmem_cache *c;
+	void *retval;
+
+	for (c = size_caches; c->name; c++)
+		if (c->size >= len)
 			break;
-	/*
-	 * If we didn't find a bucket with free space, then we'll 
-	 * allocate a new one.
-	 */
-	if (!bdesc) {
-		char* cp;
-		int	i;
-
-		if (!free_bucket_desc)	
-			init_bucket_desc();
-		bdesc = free_bucket_desc;
-		free_bucket_desc = bdesc->next;
-		bdesc->refcnt = 0;
-		bdesc->bucket_size = bdir->size;
-		bdesc->page = bdesc->freeptr = cp = (void*) get_free_page();
-		if (!cp)
-			panic("Out of memory in kernel malloc()");
-		/* Set up the chain of free objects */
-		for (i=PAGE_SIZE/bdir->size; i > 1; i--) {
-			*((char **) cp) = cp + bdir->size;
-			cp += bdir->size;
+	if (!c->name) {
+		if (len > PAGE_SIZE) {
+			printk("malloc called with impossibly large argument (%d)\n",
+				len);
+			panic("malloc: bad arg");
 		}
-		*((char **) cp) = 0;
-		bdesc->next = bdir->chain; /* OK, link it in! */
-		bdir->chain = bdesc;
-	}
-	retval = (void *) bdesc->freeptr;
-	bdesc->freeptr = *((void **) retval);
-	bdesc->refcnt++;
-	sti();	/* OK, we're safe again */
-	return(retval);
+		retval = (void *) get_free_page();	/* a page of its own */
+	} else
+		retval = kmem_cache_alloc(c);
+	if (!retval)
+		panic("Out of memory in kernel malloc()");
+	return retval;
 }
 
 /*
- * Here is the free routine.  If you know the size of the object that you
- * are freeing, then free_s() will use that information to speed up the
- * search for the bucket descriptor.
- * 
+ * Here is the free routine. The size isn't needed any more: the slab
+ * knows its cache. It is kept for the callers' sake.
+ *
  * We will #define a macro so that "free(x)" is becomes "free_s(x, 0)"
  */
 void free_s(void *obj, int size)
 {
-	void		*page;
-	struct _bucket_dir	*bdir;
-	struct bucket_desc	*bdesc, *prev;
-
-	/* Calculate what page this object lives in */
-	page = (void *)  ((unsigned long) obj & 0xfffff000);
-	/* Now search the buckets looking for that page */
-	for (bdir = bucket_dir; bdir->size; bdir++) {
-		prev = 0;
-		/* If size is zero then this conditional is always false */
-		if (bdir->size < size)
-			continue;
-		for (bdesc = bdir->chain; bdesc; bdesc = bdesc->next) {
-			if (bdesc->page == page) 
-				goto found;
-			prev = bdesc;
-		}
-	}
-	panic("Bad address passed to kernel free_s()");
-found:
-	cli(); /* To avoid race conditions */
-	*((void **)obj) = bdesc->freeptr;
-	bdesc->freeptr = obj;
-	bdesc->refcnt--;
-	if (bdesc->refcnt == 0) {
-		/*
-		 * We need to make sure that prev is still accurate.  It
-		 * may not be, if someone rudely interrupted us....
-		 */
-		if ((prev && (prev->next != bdesc)) ||
-		    (!prev && (bdir->chain != bdesc)))
-			for (prev = bdir->chain; prev; prev = prev->next)
-				if (prev->next == bdesc)
-					break;
-		if (prev)
-			prev->next = bdesc->next;
-		else {
-			if (bdir->chain != bdesc)
-				panic("malloc bucket chains corrupted");
-			bdir->chain = bdesc->next;
-		}
-		free_page((unsigned long) bdesc->page);
-		bdesc->next = free_bucket_desc;
-		free_bucket_desc = bdesc;
-	}
-	sti();
-	return;
-}
+	struct slab *s;
+	unsigned long flags;
 
+	save_flags(flags);
+	cli();
+	s = off_slab_find(obj);
+	restore_flags(flags);
+	if (s)
+		kmem_cache_free(s->cache, obj);
+	else if (!((unsigned long) obj & 0xfff))
+		free_page((unsigned long) obj);
+	else
+		kmem_cache_free(slab_of(obj)->cache, obj);
+}
@@ -32,12 +32,14 @@
  */
 
 #include <signal.h>
+#include <sys/mman.h>
 
 #include <asm/system.h>
 
 #include <linux/sched.h>
 #include <linux/head.h>
 #include <linux/kernel.h>
+#include <linux/slab.h>
 
 extern volatile int do_exit(long code);    // void --> int by Henry
 
@@ -47,14 +49,18 @@ static inline volatile void oom(void) /* ouot of memory function */
     do_exit(SIGSEGV);
 }
 
-// refresh the TLB [MOD] by Henry
+// refresh the TLB: reload the current task's page directory
 #define invalidate() \
-    __asm__("movl %0, %%cr3"::"r"(0))
+    __asm__("movl %%cr3, %%eax\n\t" \
+            "movl %%eax, %%cr3\n\t" \
+            ::: "ax")
+
+// page-directory entry for linear address 'addr' in task p's directory
+#define dir_entry(p, addr) ((unsigned long*) (p)->tss.cr3 + ((addr) >> 22))
 
 /* these are not to be changed without changing head.s etc */
 #define LOW_MEM 0x100000        // 1MB
-#define PAGING_MEMORY (15*1024*1024)
-#define PAGING_PAGES (PAGING_MEMORY>>12)
+#define HEAD_MAPPED 0x1000000   // 16MB: what head.s maps, mem_init() the rest
 #define MAP_NR(addr) (((addr)-LOW_MEM)>>12)
 #define USED 100
 
@@ -62,6 +68,7 @@ static inline volatile void oom(void) /* ouot of memory function */
                           current->start_code + current->end_code)
 
 static long HIGH_MEMORY = 0;    /* initiated in mem_init */
+static int paging_pages = 0;    /* pages from LOW_MEM to HIGH_MEMORY */
 
 #define copy_page(from, to) \
     __asm__ ("cld\n\t" \
@@ -73,40 +80,83 @@ static long HIGH_MEMORY = 0;    /* initiated in mem_init */
              "c"(PAGE_SIZE>>2) \
             )
 
-static unsigned char mem_map[PAGING_PAGES] = {0};
+#define clear_page(addr) \
+    __asm__ ("cld\n\t" \
+             "rep stosl\n\t" \
+             : \
+             : \
+             "a"(0), \
+             "D"(addr), \
+             "c"(PAGE_SIZE>>2) \
+            )
+
+static unsigned char* mem_map = NULL;  /* paging_pages, set up by mem_init */
+
+/*
+ * Free pages are kept on two stacks linked through their first word:
+ * free_list holds pages with whatever was left in them, zero_list pages
+ * that the idle task has already cleared (but for the link word).
+ * Both are touched from interrupts (malloc), hence the cli's.
+ */
+#define ZERO_POOL 64    /* pages the idle task keeps cleared */
+#define ZERO_BATCH 4    /* pages it clears per pass of the idle loop */
+
+static unsigned long free_list = 0;
+static unsigned long zero_list = 0;
+static int nr_free_pages = 0;   /* on free_list */
+static int nr_zero_pages = 0;   /* on zero_list */
+
+#define pop_page(list) \
+    ({ \
+        unsigned long __page = (list); \
+        if (__page) (list) = *(unsigned long*) __page; \
+        __page; \
+    })
+
+#define push_page(list, page) \
+    do { \
+        *(unsigned long*) (page) = (list); \
+        (list) = (page); \
+    } while (0)
 
 /*
- * Get physical address of first (actually last :-) free page, and mark it
- * used. If no free pages left, return 0.
+ * Get physical address of a free, zeroed page and mark it used. Pages
+ * from the zero pool only need their link word cleared. If no free pages
+ * left, return 0.
  */
+static int shrink_page_cache(void);
+static int swap_out(void);
+
 unsigned long get_free_page(void)
 {
-    unsigned long __res;
-
-    __asm__ ("std\n\t"                  // backwards operation
-             "repne scasb\n\t"
-             "jne 1f\n\t"
-             "movb $1, 1(%%edi)\n\t"	// set the "first" free page ocupied
-             "sall $12, %%ecx\n\t"      // sall == shll
-             "addl %2, %%ecx\n\t"       // %edx := real physical address of 
-             "movl %%ecx, %%edx\n\t"    // the new found page	
-             "movl $1024, %%ecx\n\t"    // initiate the page to 0
-             "leal 4092(%%edx), %%edi\n\t"
-             "rep stosl\n\t"
-             "movl %%edx, %%eax\n"	    // %eax := the address of the page
-             "1:\n\t"
-             :
-             "=a"(__res)
-             :
-             "0"(0), 
-             "i"(LOW_MEM), 
-             "c"(PAGING_PAGES),
-             "D"(mem_map + PAGING_PAGES - 1)    // backwards operation
-             :
-             "%edx"
-            );
-
-    return __res;
+    unsigned long flags;
+    unsigned long page;
+    bool zeroed = true;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+repeat:
+    save_flags(flags);
+    cli();
+    if ((page = pop_page(zero_list))) 
+        --nr_zero_pages;
+    else if ((page = pop_page(free_list))) {
+        --nr_free_pages;
+        zeroed = false;
+    }
+    else {
+        restore_flags(flags);
+        // swapping sleeps: not from interrupts, or with them off (IF=0)
+        if ((flags & 0x200) && (shrink_page_cache() || swap_out())) 
+            goto repeat;
+        return 0;
+    }
+    mem_map[MAP_NR(page)] = 1;
+    restore_flags(flags);
+    //////////////////////////////////////////////////////////////////////////
+    if (zeroed)
+        *(unsigned long*) page = 0;
+    else
+        clear_page(page);
+    return page;
 }
 
 /*
@@ -117,26 +167,57 @@ void free_page(unsigned long addr)
 {
     if (addr < LOW_MEM) return; // Question: why cannnot use panic()?
     if (addr >= HIGH_MEMORY) panic("trying to free nonexistent page"); 
-    addr -= LOW_MEM;
-    addr >>= 12;            // get the number of the page that need to be freed 
-    if (mem_map[addr]--) return;       // decrease the number of being used
-    mem_map[addr]=0;                   // without the step, it could be -1
-    panic("trying to free free page"); // panic again :-(
+    //////////////////////////////////////////////////////////////////////////
+    unsigned long flags;
+    save_flags(flags);
+    cli();
+    unsigned char* map = mem_map + MAP_NR(addr);
+    if (!*map) {
+        restore_flags(flags);
+        panic("trying to free free page"); // panic again :-(
+    }
+    if (!--*map) {    // the last user is gone
+        push_page(free_list, addr);
+        ++nr_free_pages;
+    }
+    restore_flags(flags);
 }
 
 /*
- * This function frees a continuous block of page tables, as needed
- * by 'exit()'. As does copy_page_tables(), this handles only 4Mb blocks,
- * a whole page table.
- * "from" stores physical address.
+ * Called by the idle task (see sys_pause()): clears a few free pages
+ * and moves them to the zero pool, so that fork() and the page fault
+ * paths don't have to clear pages themselves.
  */
-int free_page_tables(unsigned long from, unsigned long size)
+void refill_zero_pages(void)
 {
-    if (from & 0x3fffff) panic("free_page_tables called with wrong alignment");
-    if (!from) panic("Trying to free up swapper memory space");
-    //////////////////////////////////////////////////////////////////////////
-    size = (size + 0x3fffff) >> 22; // the nr of 4Mb blocks need to be freed
-    unsigned long* dir = (unsigned long*) ((from>>20) & 0xffc); 
+    unsigned long flags;
+    unsigned long page;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    for (int n = 0; n < ZERO_BATCH && nr_zero_pages < ZERO_POOL; ++n) {
+        save_flags(flags);
+        cli();
+        if ((page = pop_page(free_list))) --nr_free_pages;
+        restore_flags(flags);
+        if (!page) return;
+        /***************************************************************/
+        clear_page(page);   // it's on no list: nobody else can touch it
+        /***************************************************************/
+        save_flags(flags);
+        cli();
+        push_page(zero_list, page);
+        ++nr_zero_pages;
+        restore_flags(flags);
+    }
+}
+
+/*
+ * Frees the page tables behind 'size' directory entries from 'dir' on,
+ * and the pages in them. Returns the number of pages that were mapped.
+ */
+static long free_dir_tables(unsigned long* dir, unsigned long size)
+{
+    long mapped = 0;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
     while (size-- > 0) {           
         if (!(1 & *dir)) {
             ++dir;
@@ -144,19 +225,73 @@ int free_page_tables(unsigned long from, unsigned long size)
         }
         /****************************************************/
         unsigned long* pg_table = (unsigned long*) (0xfffff000 & *dir);
+        if (mem_map[MAP_NR((unsigned long) pg_table)] > 1) {
+            for (int nr = 0; nr < 1024; ++nr)
+                mapped += 1 & pg_table[nr];
+            free_page((unsigned long) pg_table);    // another task's too
+            *(dir++) = 0;
+            continue;
+        }
         for (int nr = 0; nr < 1024; ++nr) 
         {   // test P bit 
-            if (1 & *pg_table) free_page(0xfffff000 & *pg_table);
+            if (1 & *pg_table) {
+                free_page(0xfffff000 & *pg_table);
+                ++mapped;
+            }
+            else if (*pg_table)
+                swap_free(*pg_table >> 1);
             *(pg_table++) = 0;  // [MOD] by Henry
         }
         free_page(0xfffff000 & *dir);   // free the page TABLE
         *(dir++) = 0; 
     }
+    return mapped;
+}
+
+/*
+ * This function frees a continuous block of page tables of the current
+ * task, as needed by 'exit()'. As does copy_page_tables(), this handles
+ * only 4Mb blocks, a whole page table.
+ * "from" is a linear address.
+ */
+int free_page_tables(unsigned long from, unsigned long size)
+{
+    if (from & 0x3fffff) panic("free_page_tables called with wrong alignment");
+    if (from < KERNEL_SPACE) panic("Trying to free up swapper memory space");
     //////////////////////////////////////////////////////////////////////////
+    size = (size + 0x3fffff) >> 22; // the nr of 4Mb blocks need to be freed
+    current->rss -= free_dir_tables(dir_entry(current, from), size);
+    if (current->rss < 0) current->rss = 0;
     invalidate(); // invalidate the cr3
     return 0;
 }
 
+/*
+ * A page directory for a new task: the kernel's entries below
+ * KERNEL_SPACE, nothing above. Returns 0 if out of memory.
+ */
+unsigned long new_page_dir(void)
+{
+    unsigned long dir = get_free_page();
+    if (dir) 
+        for (int i = 0; i < (KERNEL_SPACE >> 22); ++i)
+            ((unsigned long*) dir)[i] = pg_dir[i];
+    return dir;
+}
+
+/*
+ * Frees what is left of task p's address space, and the directory itself.
+ * p must not be running, nor be current.
+ */
+void free_page_dir(struct task_struct* p)
+{
+    if (p->tss.cr3 == (long) pg_dir) panic("Trying to free the kernel's pg_dir");
+    //////////////////////////////////////////////////////////////////////////
+    free_dir_tables(dir_entry(p, KERNEL_SPACE), TASK_SIZE >> 22);
+    free_page(p->tss.cr3);
+    p->tss.cr3 = 0;
+}
+
 /*
  *  Well, here is one of the most complicated functions in mm. It
  * copies a range of linerar addresses by copying only the pages.
@@ -173,8 +308,15 @@ int free_page_tables(unsigned long from, unsigned long size)
  * doesn't take any more memory - we don't copy-on-write in the low
  * 1 Mb-range, so the pages can be shared with the kernel. Thus the
  * special case for nr=xxxx.
+ *
+ * NOTE 3!! Otherwise the page tables themselves are shared: both
+ * directory entries point at the same table, write-protected, and
+ * mem_map counts the table's users. The table is copied the first time
+ * either side writes through it (see unshare_table()). Children that
+ * exec() right away never copy anything.
  */
-int copy_page_tables(unsigned long from, unsigned long to, unsigned long size)
+int copy_page_tables(unsigned long from, unsigned long to, unsigned long size,
+                     struct task_struct* p)
 {
     unsigned long* from_page_table;
     unsigned long* to_page_table;
@@ -184,8 +326,8 @@ int copy_page_tables(unsigned long from, unsigned long to, unsigned long size)
     if ((from & 0x3fffff) || (to & 0x3fffff)) // both on 4Mb boundary :-)
         panic("copy_page_tables called with wrong alignment");
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
-    from_dir = (unsigned long*) ((from>>20) & 0xffc); /* pg_dir = 0 */
-    to_dir = (unsigned long*) ((to>>20) & 0xffc);
+    from_dir = dir_entry(current, from);
+    to_dir = dir_entry(p, to);
     // nr of page directory entries needs to copy
     for(size = ((unsigned long) (size+0x3fffff)) >> 22; 
         size-- >0;
@@ -194,6 +336,13 @@ int copy_page_tables(unsigned long from, unsigned long to, unsigned long size)
         if (1 & *to_dir) panic("copy_page_tables: already exist");
         if (!(1 & *from_dir)) continue;
         /***************************************************************/
+        if (from) {
+            *from_dir &= ~2;        // r/w:0, for both of us
+            *to_dir = *from_dir;
+            mem_map[MAP_NR(*from_dir)]++;
+            continue;
+        }
+        /***************************************************************/
         // source page table address
         from_page_table = (unsigned long*) (0xfffff000 & *from_dir);
         // get a new page for dest page table
@@ -228,6 +377,80 @@ int copy_page_tables(unsigned long from, unsigned long to, unsigned long size)
     return 0;
 }
 
+/*
+ * Brings the page 'entry' points at back from swap. This sleeps: if the
+ * entry has changed by the time the page is read, somebody else got there
+ * first, and it is left alone.
+ */
+static void swap_in(unsigned long* entry)
+{
+    unsigned long swap_nr = *entry >> 1;
+    unsigned long page = get_free_page();
+    if (!page) oom();
+    read_swap_page(swap_nr, page);
+    //////////////////////////////////////////////////////////////////////////
+    if (*entry != (swap_nr << 1)) {
+        free_page(page);
+        return;
+    }
+    swap_free(swap_nr);
+    *entry = page | PAGE_DIRTY | 7; // dirty: the copy on swap is gone
+}
+
+/*
+ * Makes the page table behind page-directory entry 'dir' (present)
+ * private to the current task, and returns it. A write-protected
+ * directory entry means copy_page_tables() shared the table: the last
+ * user just takes it back, the others get a copy whose pages are then
+ * shared copy-on-write, as a non-lazy fork would have done.
+ */
+static unsigned long* unshare_table(unsigned long* dir)
+{
+    for (;;) {
+        unsigned long old_dir = *dir;
+        unsigned long* old_table = (unsigned long*) (0xfffff000 & old_dir);
+        if (old_dir & 2) return old_table;
+        //////////////////////////////////////////////////////////////////////
+        // swapped-out pages can't be shared by two tables: bring them in
+        if (mem_map[MAP_NR((unsigned long) old_table)] > 1)
+            for (int nr = 0; nr < 1024; ++nr)
+                if (old_table[nr] && !(1 & old_table[nr])) 
+                    swap_in(old_table + nr);
+        //////////////////////////////////////////////////////////////////////
+        if (mem_map[MAP_NR((unsigned long) old_table)] == 1) {
+            *dir |= 2;
+            invalidate();
+            return old_table;
+        }
+        //////////////////////////////////////////////////////////////////////
+        unsigned long* new_table = (unsigned long*) get_free_page();
+        if (!new_table) oom();
+        // that may have slept: the other users may be gone, or have let
+        // pages go to swap. Then look again.
+        bool changed = *dir != old_dir || 
+                       mem_map[MAP_NR((unsigned long) old_table)] == 1;
+        for (int nr = 0; !changed && nr < 1024; ++nr)
+            changed = old_table[nr] && !(1 & old_table[nr]);
+        if (changed) {
+            free_page((unsigned long) new_table);
+            continue;
+        }
+        //////////////////////////////////////////////////////////////////////
+        for (int nr = 0; nr < 1024; ++nr) {
+            unsigned long this_page = old_table[nr];
+            if (!(1 & this_page)) continue;
+            /***************************************************************/
+            this_page &= ~2;            // read only, for everybody
+            old_table[nr] = new_table[nr] = this_page;
+            if (this_page > LOW_MEM) mem_map[MAP_NR(this_page)]++;
+        }
+        free_page((unsigned long) old_table);   // one user less
+        *dir = ((unsigned long) new_table) | 7;
+        invalidate();
+        return new_table;
+    }
+}
+
 /*
  * This function puts a page in memory at the wanted address.
  * It returns the physical address of the page gotten, 0 if
@@ -235,18 +458,13 @@ int copy_page_tables(unsigned long from, unsigned long to, unsigned long size)
  * page.)
  */
 // map a linear address to a physical page
-unsigned long put_page(unsigned long page, unsigned long address)
+static unsigned long map_page(unsigned long page, unsigned long address,
+                              unsigned long prot)
 {
-    /* NOTE !!! This uses the fact that _pg_dir=0 */
-    if (page < LOW_MEM || page >= HIGH_MEMORY)
-        printk("Trying to put page %p at %p\n",page,address);
-    if (mem_map[(page-LOW_MEM)>>12] != 1)
-        printk("mem_map disagrees with %p at %p\n",page,address);
-    /////////////////////////////////////////////////////////////////////////
-    unsigned long* page_table = (unsigned long*) ((address >> 20) & 0xffc); 
+    unsigned long* page_table = dir_entry(current, address);
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
     if ((*page_table) & 1) // P=1, then "page_table" get the page table address
-        page_table = (unsigned long*) (0xfffff000 & *page_table);
+        page_table = unshare_table(page_table);
     else {
         unsigned long tmp = get_free_page();
         if (!tmp) return 0;
@@ -256,35 +474,71 @@ unsigned long put_page(unsigned long page, unsigned long address)
     }
     /***********************************************************************/
     // mask 0x3ff keeps the index within the bound of 10bits
-    page_table[(address >> 12) & 0x3ff] = page | 7; 
+    page_table[(address >> 12) & 0x3ff] = page | prot; 
     /* no need for invalidate */
     return page;
 }
 
+unsigned long put_page(unsigned long page, unsigned long address)
+{
+    if (page < LOW_MEM || page >= HIGH_MEMORY)
+        printk("Trying to put page %p at %p\n",page,address);
+    if (mem_map[(page-LOW_MEM)>>12] != 1)
+        printk("mem_map disagrees with %p at %p\n",page,address);
+    /////////////////////////////////////////////////////////////////////////
+    return map_page(page, address, 7);  // U/S, R/W, P
+}
+
 // copy on write :-)
 void un_wp_page(unsigned long* table_entry)
 {
-    unsigned long old_page = 0xfffff000 & *table_entry;  // old page address
-    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
-    // mem_map[x]==1 indicates no sharing.
-    if (old_page >= LOW_MEM && mem_map[MAP_NR(old_page)] == 1) { 
-        *table_entry |= 2; // set R/W to 1
-        invalidate();
+    for (;;) {
+        unsigned long entry = *table_entry;
+        unsigned long old_page = 0xfffff000 & entry;  // old page address
+        // swapped out, or made writable, while we slept: the fault, if
+        // any, comes back
+        if (!(entry & 1) || (entry & 2)) return;
+        //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+        // mem_map[x]==1 indicates no sharing.
+        if (old_page >= LOW_MEM && mem_map[MAP_NR(old_page)] == 1) { 
+            *table_entry |= 2; // set R/W to 1
+            invalidate();
+            return;
+        }
+        //////////////////////////////////////////////////////////////////////
+        // if the page is shared, then copy it.
+        unsigned long new_page = get_free_page();
+        if (!new_page) oom(); // run out of memory :-(
+        // that may have slept: look again, as swap_in() does
+        if (*table_entry != entry || 
+            (old_page >= LOW_MEM && mem_map[MAP_NR(old_page)] == 1)) {
+            free_page(new_page);
+            continue;
+        }
+        /*******************************************************************/
+        copy_page(old_page,new_page); // copy page
+        *table_entry = new_page | 7; // set U/S, R/W, P bits
+        free_page(old_page);    // one user less
+        invalidate(); // refresh TLB
         return;
     }
-    //////////////////////////////////////////////////////////////////////////
-    // if the page is shared, then copy it.
-    unsigned long new_page = get_free_page();
-    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
-    if (!new_page) oom(); // run out of memory :-(
-    /***************************************************************/
-    if (old_page >= LOW_MEM) mem_map[MAP_NR(old_page)]--; 
-    *table_entry = new_page | 7; // set U/S, R/W, P bits
-    /***************************************************************/
-    invalidate(); // refresh TLB
-    copy_page(old_page,new_page); // copy page
 }	
 
+/*
+ * Makes the present, read-only page at 'entry' writable. A shared file
+ * mapping or a shm segment (m) writes to its own page; anything else is
+ * copied if it is shared.
+ */
+static void write_page(unsigned long* entry, struct mmap_area* m)
+{
+    if (m && (m->flags & MAP_SHARED)) {
+        *entry |= 2;
+        invalidate();
+    }
+    else 
+        un_wp_page(entry);
+}
+
 /*
  * This routine handles present pages, when users try to write
  * to a shared page. It is done by copying the page to a new address
@@ -300,22 +554,27 @@ void do_wp_page(unsigned long error_code, unsigned long address)
     if (CODE_SPACE(address))
         do_exit(SIGSEGV);
 #endif
-    // get the table entry (offset + base address of table)
-    un_wp_page((unsigned long*)
-               (((address>>10) & 0xffc) // offset in page table
-                + (0xfffff000 & *((unsigned long*) ((address>>20) & 0xffc)))));
-    // + base address of page table (stored in pg_dir)
+    unsigned long tmp = address - current->start_code;
+    struct mmap_area* m = find_mmap(current, tmp, tmp + 1);
+    if (m && !(m->prot & PROT_WRITE)) do_exit(SIGSEGV);
+    //////////////////////////////////////////////////////////////////////////
+    // the fault may be the page table's (shared after fork) or the page's
+    unsigned long* table = unshare_table(dir_entry(current, address));
+    unsigned long* entry = table + ((address>>12) & 0x3ff);
+    if (!(2 & *entry)) write_page(entry, m);
 }
 
 void write_verify(unsigned long address)
 {
-    unsigned long page = *((unsigned long *) ((address>>20) & 0xffc));
-    if (!(page & 1)) return; // test P bit of page directory entry
+    unsigned long* dir = dir_entry(current, address);
+    if (!(*dir & 1)) return; // test P bit of page directory entry
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
-    page &= PAGE_MASK; // extract page table address
-    page += ((address>>10) & 0xffc); // add offset to get the page adress
-    if ((3 & *(unsigned long*) page) == 1)  /* read-only, present */
-        un_wp_page((unsigned long*) page);  // then need copy page
+    // the kernel ignores r/w bits: unshare the table by hand
+    unsigned long* page = unshare_table(dir) + ((address>>12) & 0x3ff);
+    if ((3 & *page) == 1) { /* read-only, present */
+        unsigned long tmp = address - current->start_code;
+        write_page(page, find_mmap(current, tmp, tmp + 1));
+    }
     return;
 }
 
@@ -329,6 +588,32 @@ void get_empty_page(unsigned long address)
     }
 }
 
+/*
+ * Unmaps the current task's pages in [from, from+size) (linear, page
+ * aligned), freeing them and whatever they had on swap. sys_brk() uses
+ * it to give back the heap.
+ */
+void unmap_page_range(unsigned long from, unsigned long size)
+{
+    for (; size; from += PAGE_SIZE, size -= PAGE_SIZE) {
+        unsigned long* dir = dir_entry(current, from);
+        if (!(*dir & 1)) continue;
+        /***************************************************************/
+        unsigned long* entry = (unsigned long*) (0xfffff000 & *dir) + 
+                               ((from>>12) & 0x3ff);
+        if (!*entry) continue;
+        entry = unshare_table(dir) + ((from>>12) & 0x3ff);
+        if (*entry & 1) {
+            free_page(0xfffff000 & *entry);
+            if (current->rss > 0) --current->rss;
+        }
+        else if (*entry)
+            swap_free(*entry >> 1);
+        *entry = 0;
+    }
+    invalidate();
+}
+
 /*
  * try_to_share() checks the page at address "address" in the task "p",
  * to see if it exists, and if it is clean. If so, share it with the current
@@ -345,9 +630,8 @@ static int try_to_share(unsigned long address, struct task_struct* p)
     unsigned long to_page;
     unsigned long phys_addr;
 
-    from_page = to_page = ((address>>20) & 0xffc); // page dir offset
-    from_page += ((p->start_code>>20) & 0xffc);    // page dir offset for code
-    to_page += ((current->start_code>>20) & 0xffc);
+    from_page = (unsigned long) dir_entry(p, p->start_code + address);
+    to_page = (unsigned long) dir_entry(current, current->start_code + address);
     /* is there a page-directory at from? */
     from = *(unsigned long *) from_page; // get the page dir entry
     if (!(from & 1))                     // test P bit
@@ -369,6 +653,8 @@ static int try_to_share(unsigned long address, struct task_struct* p)
         else
             oom();
     }
+    else
+        to = (unsigned long) unshare_table((unsigned long *) to_page);
     to &= 0xfffff000;           /*  get page table */
     to_page = to + ((address>>10) & 0xffc); /*  get page table entry */
     ///////////////////////////////////////////////////////////
@@ -408,6 +694,433 @@ static int share_page(unsigned long address)
     return 0;
 }
 
+/*
+ * The page cache. Pages of executables and mapped files read in by
+ * do_no_page() are kept here, keyed by (device, inode, offset in the
+ * file), and the cache holds a reference to each. Every task running the
+ * binary maps the cached page read-only, so writes to data pages get
+ * copied as usual; shared file mappings write into it. The pages stay
+ * after the last of them exits, until memory runs short
+ * (shrink_page_cache()) or the file changes (invalidate_cached_pages()).
+ * An image page starts a block into its page of the file (the header
+ * comes first), a mapped one on a page boundary, so the two never mix.
+ * NR_CACHED_PAGES entries to start with; shared mappings that pin them
+ * all get more, a page of entries at a time (grow_page_cache()).
+ */
+#define NR_CACHED_PAGES 512
+#define PAGE_HASH_SIZE 128
+#define page_hashfn(dev, ino, offset) \
+    ((((dev) ^ (ino)) * 31 + ((offset) >> 12)) & (PAGE_HASH_SIZE-1))
+#define inode_hashfn(dev, ino) (((dev) ^ (ino)) & 0xff)
+
+static struct cached_page {
+    unsigned short dev;
+    unsigned short ino;
+    unsigned long offset;
+    unsigned long page;                 /* 0 if the entry is unused */
+    struct cached_page* next_hash;
+    struct cached_page* prev_lru;       /* least recently used first */
+    struct cached_page* next_lru;
+} cached_pages[NR_CACHED_PAGES] = {};
+
+static struct cached_page* page_hash[PAGE_HASH_SIZE] = {};
+static struct cached_page page_lru = { .prev_lru = &page_lru, 
+                                       .next_lru = &page_lru };
+/* pages cached per inode hash: lets writers skip the scan when 0 */
+static unsigned short inode_pages[256] = {};
+
+static inline void lru_to(struct cached_page* p, struct cached_page* before)
+{
+    p->prev_lru->next_lru = p->next_lru;
+    p->next_lru->prev_lru = p->prev_lru;
+    p->next_lru = before;
+    p->prev_lru = before->prev_lru;
+    before->prev_lru->next_lru = p;
+    before->prev_lru = p;
+}
+
+static void drop_cached_page(struct cached_page* p)
+{
+    struct cached_page** pp = page_hash + page_hashfn(p->dev, p->ino, 
+                                                      p->offset);
+    while (*pp != p) pp = &(*pp)->next_hash;
+    *pp = p->next_hash;
+    --inode_pages[inode_hashfn(p->dev, p->ino)];
+    /***************************************************************/
+    free_page(p->page);     // the cache's reference
+    p->page = 0;
+    lru_to(p, page_lru.next_lru);   // reuse it first
+}
+
+static unsigned long find_cached_page(int dev, int ino, unsigned long offset)
+{
+    struct cached_page* p = page_hash[page_hashfn(dev, ino, offset)];
+    for (; p; p = p->next_hash)
+        if (p->dev == dev && p->ino == ino && p->offset == offset) {
+            lru_to(p, &page_lru);
+            return p->page;
+        }
+    return 0;
+}
+
+/*
+ * Caches page, taking a reference to it. Uses an unused entry or one
+ * whose page nobody maps any more; returns 0 if there is none.
+ */
+static int add_cached_page(int dev, int ino, unsigned long offset,
+                           unsigned long page)
+{
+    struct cached_page* p = page_lru.next_lru;
+    for (; p != &page_lru; p = p->next_lru) {
+        if (!p->page) break;
+        if (mem_map[MAP_NR(p->page)] == 1) {
+            drop_cached_page(p);
+            break;
+        }
+    }
+    if (p == &page_lru) return 0;
+    //////////////////////////////////////////////////////////////////////////
+    p->dev = dev;
+    p->ino = ino;
+    p->offset = offset;
+    p->page = page;
+    mem_map[MAP_NR(page)]++;
+    struct cached_page** head = page_hash + page_hashfn(dev, ino, offset);
+    p->next_hash = *head;
+    *head = p;
+    ++inode_pages[inode_hashfn(dev, ino)];
+    lru_to(p, &page_lru);
+    return 1;
+}
+
+/*
+ * Every entry holds a page somebody maps: adds a page of unused ones.
+ * Returns 0 if there is no memory for it. This may sleep. The entries
+ * stay for good.
+ */
+static int grow_page_cache(void)
+{
+    struct cached_page* p = (struct cached_page*) get_free_page();
+    if (!p) return 0;
+    //////////////////////////////////////////////////////////////////////////
+    for (int i = 0; i < PAGE_SIZE / sizeof(struct cached_page); ++i) {
+        p[i].page = 0;
+        p[i].next_lru = p[i].prev_lru = p + i;
+        lru_to(p + i, page_lru.next_lru);   // used first
+    }
+    return 1;
+}
+
+/*
+ * Frees the least recently used cached page nobody maps. Returns 1 if
+ * it found one.
+ */
+static int shrink_page_cache(void)
+{
+    for (struct cached_page* p = page_lru.next_lru; p != &page_lru; 
+         p = p->next_lru)
+        if (p->page && mem_map[MAP_NR(p->page)] == 1) {
+            drop_cached_page(p);
+            return 1;
+        }
+    return 0;
+}
+
+/*
+ * The file (ino == 0: every file on dev) has changed: forget its pages.
+ * Tasks that map an image page keep their copy. A mapped-file page that
+ * is still mapped stays: shared mappings write into it, and dropping it
+ * would leave them on a page sync_mmap_pages() then writes back stale.
+ * write() keeps it current instead (update_cached_page()).
+ */
+void invalidate_cached_pages(int dev, int ino)
+{
+    if (ino && !inode_pages[inode_hashfn(dev, ino)]) return;
+    //////////////////////////////////////////////////////////////////////////
+    struct cached_page* next;
+    for (struct cached_page* p = page_lru.next_lru; p != &page_lru; 
+         p = next) {
+        next = p->next_lru;     // dropping moves p to the front
+        if (!p->page || p->dev != dev || (ino && p->ino != ino)) continue;
+        if (ino && !(p->offset & PAGE_OFFSET_MASK) && 
+            mem_map[MAP_NR(p->page)] > 1) 
+            continue;
+        drop_cached_page(p);
+    }
+}
+
+/*
+ * write() put the count bytes at 'from' at 'pos' in the file: copies them
+ * into the cached mapped-file page, if any, so the tasks mapping it see
+ * them. They never cross a page, as write() copies a block at a time.
+ */
+void update_cached_page(int dev, int ino, unsigned long pos, 
+                        const char* from, int count)
+{
+    if (!inode_pages[inode_hashfn(dev, ino)]) return;
+    unsigned long page = find_cached_page(dev, ino, pos & PAGE_MASK);
+    if (!page) return;
+    char* to = (char*)page + (pos & PAGE_OFFSET_MASK);
+    while (count-- > 0) *to++ = *from++;
+}
+
+/*
+ * Pages out one page of task p at linear address 'address'. Clean pages
+ * that came straight from the executable are just dropped: do_no_page()
+ * reads them again. Anything else goes to swap, if there is room.
+ * Shared pages are left alone. Returns 1 if a page was freed.
+ */
+static int try_to_swap_out(struct task_struct* p, unsigned long address,
+                           unsigned long* entry)
+{
+    unsigned long page = 0xfffff000 & *entry;
+    if (page < LOW_MEM || page >= HIGH_MEMORY) return 0;
+    if (mem_map[MAP_NR(page)] != 1) return 0;
+    //////////////////////////////////////////////////////////////////////////
+    if (!(*entry & PAGE_DIRTY) && p->executable && 
+        address - p->start_code < p->end_data) {
+        *entry = 0;
+        invalidate();
+        free_page(page);
+        if (p->rss > 0) --p->rss;
+        return 1;
+    }
+    //////////////////////////////////////////////////////////////////////////
+    int swap_nr = get_swap_page();
+    if (!swap_nr) return 0;
+    *entry = swap_nr << 1;      // from now on faults go to swap_in()
+    invalidate();
+    if (p->rss > 0) --p->rss;
+    write_swap_page(swap_nr, page);
+    free_page(page);
+    return 1;
+}
+
+#define NR_DIRS (TASK_SIZE >> 22)     /* page tables in a task's space */
+
+/*
+ * The first page table at or after dir_nr that p can have pages under:
+ * text, data and heap up to brk, the mapped areas, and the stack's reach.
+ * NR_DIRS if there is none.
+ */
+static int next_dir(struct task_struct* p, int dir_nr)
+{
+    int next = NR_DIRS;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+#define EXTENT(start, end) \
+    if ((end) > (start) && (int) (((end) - 1) >> 22) >= dir_nr) { \
+        int first = (start) >> 22; \
+        if (first < dir_nr) first = dir_nr; \
+        if (first < next) next = first; \
+    }
+    EXTENT(0UL, p->brk);
+    for (struct mmap_area* m = p->mmap; m < p->mmap + NR_MMAP; ++m)
+        if (MMAP_USED(m)) EXTENT(m->start, m->end);
+    unsigned long stack = STACK_BOTTOM(p);
+    EXTENT(stack > p->brk ? stack : p->brk, TASK_SIZE);
+#undef EXTENT
+    return next;
+}
+
+/*
+ * The page-out clock: sweeps the address spaces of all tasks but task 0,
+ * only where they can have pages (next_dir()). Pages with the accessed bit
+ * set get it cleared and another round; the first page found without it
+ * is paged out. Tables shared since fork() are skipped. Gives up after
+ * going round twice. Returns 1 if a page was freed.
+ */
+static int swap_out(void)
+{
+    static int task_nr = 1;     // where the hand is: task slot,
+    static int dir_nr = 0;      // page table in its address space,
+    static int page_nr = 0;     // page in the table
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    for (int tasks = 2 * (NR_TASKS-1) + 1; tasks; ) {
+        struct task_struct* p = task[task_nr];
+        int next = NR_DIRS;     // an empty slot is one step
+        if (p && p->tss.cr3 && p->state != TASK_ZOMBIE)
+            next = next_dir(p, dir_nr);
+        if (next != dir_nr) page_nr = 0;
+        dir_nr = next;
+        if (dir_nr >= NR_DIRS) {
+            dir_nr = 0;
+            if (++task_nr >= NR_TASKS) task_nr = 1;
+            --tasks;
+            continue;
+        }
+        /*******************************************************************/
+        unsigned long address = TASK_BASE(task_nr) + (dir_nr << 22);
+        if ((*dir_entry(p, address) & 3) == 3) {
+            unsigned long* table = (unsigned long*) 
+                                   (0xfffff000 & *dir_entry(p, address));
+            bool aged = false;
+            for (; page_nr < 1024; ++page_nr) {
+                unsigned long* entry = table + page_nr;
+                if (!(*entry & 1)) continue;
+                if (*entry & PAGE_ACCESSED) {
+                    *entry &= ~PAGE_ACCESSED;
+                    aged = true;
+                    continue;
+                }
+                if (try_to_swap_out(p, address + (page_nr << 12), entry)) {
+                    ++page_nr;
+                    return 1;
+                }
+            }
+            if (aged) invalidate();
+        }
+        page_nr = 0;
+        ++dir_nr;
+    }
+    return 0;
+}
+
+/*
+ * Reads the page at 'offset' (page aligned) of a regular file. Holes and
+ * whatever lies past the end of the file read as zeroes.
+ */
+static void read_file_page(struct m_inode* inode, unsigned long offset,
+                           unsigned long page)
+{
+    int nr[4];
+    int block = offset / BLOCK_SIZE;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    for (int i = 0; i < 4; ++i, ++block)
+        nr[i] = (block * BLOCK_SIZE < inode->i_size) ? bmap(inode, block) : 0;
+    bread_page(page, inode->i_dev, nr);
+    //////////////////////////////////////////////////////////////////////////
+    if (offset + PAGE_SIZE > inode->i_size) {
+        unsigned long valid = (offset < inode->i_size) ? 
+                              inode->i_size - offset : 0;
+        for (char* c = (char*) page + valid; c < (char*) page + PAGE_SIZE; )
+            *c++ = 0;
+    }
+}
+
+/*
+ * Writes the page back to the file at 'offset', through the buffer cache.
+ * Blocks past the end of the file are left out: a mapping doesn't grow
+ * the file. Holes get blocks.
+ */
+static void write_file_page(struct m_inode* inode, unsigned long offset,
+                            unsigned long page)
+{
+    int nr[4];
+    int block = offset / BLOCK_SIZE;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    mem_map[MAP_NR(page)]++;    // getblk() sleeps: keep it meanwhile
+    for (int i = 0; i < 4; ++i, ++block)
+        nr[i] = (block * BLOCK_SIZE < inode->i_size) ? 
+                create_block(inode, block) : 0;
+    bwrite_page(page, inode->i_dev, nr);
+    free_page(page);
+}
+
+/*
+ * A fault in a file mapping (see mm/mmap.c): the page comes from the page
+ * cache. A private mapping gets it read-only, and writes copy it as for
+ * executables. A shared writable mapping writes into the cached page
+ * itself, and sync_mmap_pages() writes it back.
+ */
+static void do_mmap_page(struct mmap_area* m, unsigned long address,
+                         unsigned long offset)
+{
+    struct m_inode* inode = m->inode;
+    unsigned long prot = ((m->flags & MAP_SHARED) && (m->prot & PROT_WRITE)) 
+                         ? 7 : 5;
+    unsigned long page = find_cached_page(inode->i_dev, inode->i_num, offset);
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    if (page) 
+        mem_map[MAP_NR(page)]++;
+    else {
+        if (!(page = get_free_page())) oom();
+        read_file_page(inode, offset, page);
+        for (;;) {
+            // that slept: somebody may have cached the page meanwhile
+            unsigned long cached = find_cached_page(inode->i_dev, 
+                                                    inode->i_num, offset);
+            if (cached) {
+                free_page(page);
+                page = cached;
+                mem_map[MAP_NR(page)]++;
+                break;
+            }
+            if (add_cached_page(inode->i_dev, inode->i_num, offset, page))
+                break;
+            // the cache is full. A private mapping can do with a page of
+            // its own; a shared one can't, or the other tasks mapping the
+            // file and write() would never see it.
+            if (!(m->flags & MAP_SHARED)) break;
+            if (!grow_page_cache()) {
+                free_page(page);
+                oom();
+            }
+        }
+    }
+    if (map_page(page, address, prot)) return;
+    free_page(page);
+    oom();
+}
+
+/*
+ * A fault in an attached shared memory segment (see mm/shm.c): every
+ * task maps the segment's own page, so writes are seen by all of them.
+ */
+static void do_shm_page(struct mmap_area* m, unsigned long address,
+                        unsigned long nr)
+{
+    unsigned long page = shm_page(m->shm, nr);
+    if (!page) oom();
+    mem_map[MAP_NR(page)]++;
+    if (map_page(page, address, (m->prot & PROT_WRITE) ? 7 : 5)) return;
+    free_page(page);
+    oom();
+}
+
+/*
+ * Writes back the dirty pages of task p's shared mapping m in [from, to)
+ * (offsets in p's data segment, page aligned).
+ */
+void sync_mmap_pages(struct task_struct* p, struct mmap_area* m,
+                     unsigned long from, unsigned long to)
+{
+    for (; from < to; from += PAGE_SIZE) {
+        unsigned long address = p->start_code + from;
+        unsigned long* dir = dir_entry(p, address);
+        if (!(*dir & 1)) continue;
+        /***************************************************************/
+        unsigned long* entry = (unsigned long*) (0xfffff000 & *dir) + 
+                               ((address>>12) & 0x3ff);
+        if ((*entry & (PAGE_DIRTY | 1)) != (PAGE_DIRTY | 1)) continue;
+        *entry &= ~PAGE_DIRTY;
+        invalidate();
+        write_file_page(m->inode, m->offset + (from - m->start), 
+                        0xfffff000 & *entry);
+    }
+}
+
+/*
+ * Faults of a.out tasks between the heap and the stack (and outside any
+ * file mapping), and faults that
+ * would take a task past its resident-set limit, kill it: it asked for
+ * more than it may have, better it goes now than the machine runs out of
+ * memory later.
+ */
+static void check_no_page(unsigned long tmp)
+{
+    if (current->executable && tmp >= current->end_data &&
+        !find_mmap(current, tmp, tmp + 1)) {
+        unsigned long heap = PAGE_ALIGN(current->brk);
+        unsigned long stack = STACK_BOTTOM(current);
+        if (stack < heap + STACK_GUARD) stack = heap + STACK_GUARD;
+        if (tmp >= heap && tmp < stack) do_exit(SIGSEGV);
+    }
+    if (current->rss >= (current->rlim[RLIMIT_RSS].rlim_cur >> 12)) {
+        printk("pid %d: RSS limit exceeded\n\r", current->pid);
+        do_exit(SIGSEGV);
+    }
+}
+
 // the page wanted is not in memory
 // you need some file system knowledge to understand the function
 void do_no_page(unsigned long error_code, unsigned long address)
@@ -418,13 +1131,41 @@ void do_no_page(unsigned long error_code, unsigned long address)
     int block,i;
     /***************************************************************/
     address &= PAGE_MASK;
+    unsigned long* dir = dir_entry(current, address);
+    if ((*dir & 1) && 
+        ((unsigned long*) (0xfffff000 & *dir))[(address>>12) & 0x3ff]) {
+        // paged out: unsharing the table may already bring it back
+        check_no_page(address - current->start_code);
+        unsigned long* entry = unshare_table(dir) + ((address>>12) & 0x3ff);
+        if (!(*entry & 1)) swap_in(entry);
+        ++current->rss;
+        return;
+    }
     tmp = address - current->start_code;
+    check_no_page(tmp);
+    ++current->rss;     // one way or another, or we don't come back
     //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;; 
+    struct mmap_area* m = find_mmap(current, tmp, tmp + 1);
+    if (m) {
+        if (m->shm)
+            do_shm_page(m, address, (m->offset + (tmp - m->start)) >> 12);
+        else
+            do_mmap_page(m, address, m->offset + (tmp - m->start));
+        return;
+    }
     if (!current->executable || tmp >= current->end_data) {
         get_empty_page(address);
         return;
     }
     //////////////////////////////////////////////////////////////////////////
+    struct m_inode* inode = current->executable;
+    unsigned long offset = tmp + BLOCK_SIZE;    // in the file
+    if ((page = find_cached_page(inode->i_dev, inode->i_num, offset))) {
+        mem_map[MAP_NR(page)]++;
+        if (map_page(page, address, 5)) return;     // read-only
+        free_page(page);
+        oom();
+    }
     if (share_page(tmp)) return;
     if (!(page = get_free_page())) oom();
     //////////////////////////////////////////////////////////////////////////
@@ -440,45 +1181,84 @@ void do_no_page(unsigned long error_code, unsigned long address)
     while (i-- > 0) // .bss must be zero out
         *(char*) (--tmp) = 0;   
     /***************************************************************/
-    if (put_page(page, address)) return;
+    if (add_cached_page(inode->i_dev, inode->i_num, offset, page)) {
+        if (map_page(page, address, 5)) return;     // shared with the cache
+    }
+    else if (put_page(page, address)) 
+        return;
     free_page(page);
     oom();
 }
 
 /*
- * mark buffer area (and Ramdisk, if there is any) and pages outside
- * physical limit USED and user accessible area available
+ * head.s maps only the first 16MB. Map the rest of physical memory 1:1
+ * in the same way, with page tables taken from the start of paging
+ * memory, then put mem_map after them. Mark buffer area (and Ramdisk, if
+ * there is any) and all of this USED and user accessible area available.
  */
 void mem_init(long start_mem, long end_mem)
 {
     int i;
 
+    for (unsigned long addr = HEAD_MAPPED; addr < end_mem; addr += 0x400000) {
+        unsigned long* pg_table = (unsigned long*) start_mem;
+        start_mem += PAGE_SIZE;
+        for (i = 0; i < 1024; ++i)
+            pg_table[i] = (addr + (i << 12)) | 7;   // r/w user, present
+        pg_dir[addr >> 22] = ((unsigned long) pg_table) | 7;
+    }
+    invalidate();
+    //////////////////////////////////////////////////////////////////////////
+    for (i = 0; i < NR_CACHED_PAGES; ++i) {    // all unused, on the lru
+        cached_pages[i].next_lru = &page_lru;
+        cached_pages[i].prev_lru = page_lru.prev_lru;
+        page_lru.prev_lru->next_lru = cached_pages + i;
+        page_lru.prev_lru = cached_pages + i;
+    }
+    //////////////////////////////////////////////////////////////////////////
     HIGH_MEMORY = end_mem;
-    for (i = 0; i < PAGING_PAGES; i++)  // it marks all pages outside
-        mem_map[i] = USED;              // physical limit USED
-    i = MAP_NR(start_mem);
-    end_mem -= start_mem;
-    end_mem >>= 12;
-    while (end_mem-- > 0)
-        mem_map[i++]=0;
+    paging_pages = (end_mem - LOW_MEM) >> 12;
+    mem_map = (unsigned char*) start_mem;
+    start_mem += (paging_pages + PAGE_SIZE - 1) & PAGE_MASK;
+    for (i = 0; i < paging_pages; i++)  // it marks all pages below
+        mem_map[i] = USED;              // start_mem USED
+    // free pages go on the free list lowest first, so the highest
+    // page is handed out first as before
+    for (; start_mem < end_mem; start_mem += PAGE_SIZE) {
+        mem_map[MAP_NR(start_mem)] = 0;
+        push_page(free_list, start_mem);
+        ++nr_free_pages;
+    }
+}
+
+// counts the present pages under directory entries [from, to) of dir
+static void calc_dir(int nr, unsigned long* dir, int from, int to)
+{
+    for (int i = from; i < to; i++) {
+        if (!(1 & dir[i])) continue;
+        unsigned long* pg_tbl = (unsigned long*) (0xfffff000 & dir[i]);
+        int k = 0;
+        for (int j = 0; j < 1024; j++)
+            if (pg_tbl[j] & 1) k++;
+        printk("Task %d: pg-dir[%d] uses %d pages\n", nr, i, k);
+    }
 }
 
 // the function is simple :-)
 void calc_mem(void)
 {
-    int i,j,k,free=0;
-    long * pg_tbl;
+    int i, free = 0;
 
-    for(i=0 ; i<PAGING_PAGES ; i++)
+    for(i=0 ; i<paging_pages ; i++)
         if (!mem_map[i]) free++;
-    printk("%d pages free (of %d)\n\r",free,PAGING_PAGES);
-    for(i=2 ; i<1024 ; i++) {
-        if (1&pg_dir[i]) {
-            pg_tbl=(long *) (0xfffff000 & pg_dir[i]);
-            for(j=k=0 ; j<1024 ; j++)
-                if (pg_tbl[j]&1)
-                    k++;
-            printk("Pg-dir[%d] uses %d pages\n",i,k);
-        }
-    }
+    printk("%d pages free (of %d), %d of them zeroed\n\r", free, 
+           paging_pages, nr_zero_pages);
+    // the kernel's part is the same in every directory: pg_dir's will do.
+    // Page tables children still share are counted for each of them.
+    calc_dir(0, pg_dir, 2, 1024);
+    for (i = 1; i < NR_TASKS; i++)
+        if (task[i] && task[i]->tss.cr3)
+            calc_dir(i, (unsigned long*) task[i]->tss.cr3, 
+                     KERNEL_SPACE >> 22, 1024);
+    kmem_cache_stats();
 }
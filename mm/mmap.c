@@ -0,0 +1,238 @@
+/*
+ *  linux/mm/mmap.c
+ *
+ *  (C) 1991  Linus Torvalds
+ */
+
+/*
+ * mmap() and munmap() of regular files. This file keeps track of which
+ * part of a task's data segment shows which file (task_struct.mmap[]);
+ * the pages themselves are faulted in, copied and written back by
+ * memory.c, through the page cache. Shared memory segments (shm.c) are
+ * attached as areas too.
+ *
+ * Mappings go between the heap and the stack, first fit upwards from
+ * TASK_UNMAPPED_BASE. They stay below 2Gb, so an address returned is
+ * never taken for an error code.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <asm/segment.h>
+
+#define TASK_UNMAPPED_BASE 0x40000000   /* 1Gb */
+#define TASK_UNMAPPED_END  0x80000000   /* 2Gb */
+
+/*
+ * Where the stack may reach, less the guard gap: mappings end below it.
+ */
+static unsigned long mmap_limit(void)
+{
+    unsigned long stack = STACK_BOTTOM(current);
+    if (!stack || stack > current->start_stack) stack = current->start_stack;
+    if (stack > TASK_UNMAPPED_END + STACK_GUARD)
+        return TASK_UNMAPPED_END;
+    return (stack > STACK_GUARD) ? stack - STACK_GUARD : 0;
+}
+
+static unsigned long get_unmapped_area(unsigned long len)
+{
+    unsigned long addr = TASK_UNMAPPED_BASE;
+    unsigned long heap = PAGE_ALIGN(current->brk) + STACK_GUARD;
+    struct mmap_area* m;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+    if (addr < heap) addr = heap;
+    while (addr + len > addr && addr + len <= mmap_limit()) {
+        if (!(m = find_mmap(current, addr, addr + len))) return addr;
+        addr = m->end;
+    }
+    return 0;
+}
+
+/* the area's hold on its file or segment */
+static void get_mmap(struct mmap_area* m)
+{
+    if (m->inode) 
+        m->inode->i_count++;
+    else
+        shm_attach(m->shm);
+}
+
+static void put_mmap(struct mmap_area* m)
+{
+    if (m->inode) 
+        iput(m->inode);
+    else
+        shm_detach(m->shm);
+    m->inode = NULL;
+    m->shm = NULL;
+}
+
+static inline bool shared_writable(struct mmap_area* m)
+{
+    return m->inode && (m->flags & MAP_SHARED) && (m->prot & PROT_WRITE);
+}
+
+/*
+ **************************** INTERFACE **************************************
+ */
+
+/*
+ * Unmaps [start, end) of the current task: writes back what shared
+ * mappings have dirtied there, frees the pages, and trims, splits or
+ * drops the areas. Returns -ENOMEM if a split finds no free slot.
+ */
+int do_munmap(unsigned long start, unsigned long end)
+{
+    struct mmap_area* m;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+    while ((m = find_mmap(current, start, end))) {
+        unsigned long from = (start > m->start) ? start : m->start;
+        unsigned long to = (end < m->end) ? end : m->end;
+        /*******************************************************************/
+        if (from > m->start && to < m->end) {    // a hole in the middle
+            struct mmap_area* n = current->mmap;
+            while (n < current->mmap + NR_MMAP && MMAP_USED(n)) ++n;
+            if (n >= current->mmap + NR_MMAP) return -ENOMEM;
+            *n = *m;
+            n->start = to;
+            n->offset += to - m->start;
+            get_mmap(n);
+            m->end = to;
+        }
+        /*******************************************************************/
+        if (shared_writable(m)) sync_mmap_pages(current, m, from, to);
+        unmap_page_range(current->start_code + from, to - from);
+        if (from == m->start && to == m->end) 
+            put_mmap(m);
+        else if (from == m->start) {
+            m->offset += to - m->start;
+            m->start = to;
+        }
+        else
+            m->end = from;
+    }
+    return 0;
+}
+
+/*
+ * Finds room for len bytes (at addr if fixed, replacing whatever was
+ * there) and a free slot, and sets the slot's start and end. Returns the
+ * address, or -errno.
+ */
+long new_mmap(unsigned long addr, unsigned long len, int fixed,
+              struct mmap_area** area)
+{
+    if (fixed) {
+        if ((addr & ~PAGE_MASK) || addr + len < addr) return -EINVAL;
+        if (addr < PAGE_ALIGN(current->brk) + STACK_GUARD ||
+            addr + len > mmap_limit())
+            return -ENOMEM;
+        int error = do_munmap(addr, addr + len);
+        if (error) return error;
+    }
+    else if (!(addr = get_unmapped_area(len)))
+        return -ENOMEM;
+    //////////////////////////////////////////////////////////////////////////
+    struct mmap_area* m = current->mmap;
+    while (m < current->mmap + NR_MMAP && MMAP_USED(m)) ++m;
+    if (m >= current->mmap + NR_MMAP) return -ENOMEM;
+    /***************************************************************/
+    m->start = addr;
+    m->end = addr + len;
+    *area = m;
+    return addr;
+}
+
+/*
+ * The first area of task p overlapping [from, to), NULL if none.
+ */
+struct mmap_area* find_mmap(struct task_struct* p,
+                            unsigned long from, unsigned long to)
+{
+    for (struct mmap_area* m = p->mmap; m < p->mmap + NR_MMAP; ++m)
+        if (MMAP_USED(m) && m->start < to && from < m->end) return m;
+    return NULL;
+}
+
+/* fork(): the child has copied the areas, and now shares the objects */
+void copy_mmap(struct task_struct* p)
+{
+    for (struct mmap_area* m = p->mmap; m < p->mmap + NR_MMAP; ++m)
+        if (MMAP_USED(m)) get_mmap(m);
+}
+
+/* exit() and exec(): before the page tables go */
+void exit_mmap(void)
+{
+    for (struct mmap_area* m = current->mmap; m < current->mmap + NR_MMAP; ++m)
+        if (MMAP_USED(m)) {
+            if (shared_writable(m)) 
+                sync_mmap_pages(current, m, m->start, m->end);
+            put_mmap(m);
+        }
+}
+
+/* sys_sync(): the dirty pages of every shared writable mapping */
+void sync_mmaps(void)
+{
+    for (int i = 1; i < NR_TASKS; ++i) {
+        struct task_struct* p = task[i];
+        if (!p || p->state == TASK_ZOMBIE) continue;
+        /*******************************************************************/
+        for (struct mmap_area* m = p->mmap; m < p->mmap + NR_MMAP; ++m)
+            if (shared_writable(m)) sync_mmap_pages(p, m, m->start, m->end);
+    }
+}
+
+int sys_mmap(struct mmap_arg_struct* arg)
+{
+    unsigned long addr = get_fs_long(&arg->addr);
+    unsigned long len = PAGE_ALIGN(get_fs_long(&arg->len));
+    int prot = get_fs_long(&arg->prot);
+    int flags = get_fs_long(&arg->flags);
+    unsigned int fd = get_fs_long(&arg->fd);
+    unsigned long offset = get_fs_long(&arg->offset);
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+    struct file* file;
+    if (fd >= NR_OPEN || !(file = current->filp[fd])) return -EBADF;
+    if (!S_ISREG(file->f_inode->i_mode)) return -ENODEV;
+    if (!len || (offset & ~PAGE_MASK) || offset + len < offset)
+        return -EINVAL;
+    //////////////////////////////////////////////////////////////////////////
+    switch (flags & MAP_TYPE) {
+        case MAP_SHARED:
+            if ((prot & PROT_WRITE) &&
+                (file->f_flags & O_ACCMODE) == O_RDONLY)
+                return -EACCES;
+            break;
+        case MAP_PRIVATE:
+            break;
+        default:
+            return -EINVAL;
+    }
+    if ((file->f_flags & O_ACCMODE) == O_WRONLY) return -EACCES;
+    //////////////////////////////////////////////////////////////////////////
+    struct mmap_area* m;
+    long res = new_mmap(addr, len, flags & MAP_FIXED, &m);
+    if (res < 0) return res;
+    /***************************************************************/
+    m->offset = offset;
+    m->inode = file->f_inode;
+    m->inode->i_count++;
+    m->prot = prot;
+    m->flags = flags & MAP_TYPE;
+    return res;
+}
+
+int sys_munmap(unsigned long addr, unsigned long len)
+{
+    len = PAGE_ALIGN(len);
+    if ((addr & ~PAGE_MASK) || !len || addr + len < addr) return -EINVAL;
+    //////////////////////////////////////////////////////////////////////////
+    return do_munmap(addr, addr + len);
+}
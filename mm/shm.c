@@ -0,0 +1,228 @@
+/*
+ *  linux/mm/shm.c
+ *
+ *  (C) 1991  Linus Torvalds
+ */
+
+/*
+ * System V shared memory: shmget(), shmat(), shmdt() and shmctl().
+ *
+ * A segment is a set of pages the segment itself holds a reference to
+ * (mem_map), got the first time some task touches them. shmat() attaches
+ * it as an area of the task's data segment (see mmap.c), and the page
+ * fault code maps the segment's pages there writable, so every attached
+ * task sees the same memory, without copies. The pages are never swapped:
+ * as long as the segment exists, they are used by more than one.
+ *
+ * A removed segment goes when the last task detaches.
+ */
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <asm/segment.h>
+
+#define SHM_PAGES (SHMMAX / PAGE_SIZE)     /* one page of page pointers */
+
+static struct shm_segment {
+    struct shmid_ds ds;
+    unsigned long* pages;   /* NULL: slot unused */
+    int npages;
+    bool removed;           /* IPC_RMID, but still attached */
+} segments[SHMMNI] = {};
+
+#define shm_id(shp) ((shp)->ds.shm_perm.seq * SHMMNI + ((shp) - segments))
+
+static struct shm_segment* find_shm(int shmid)
+{
+    if (shmid < 0) return NULL;
+    struct shm_segment* shp = segments + shmid % SHMMNI;
+    if (!shp->pages || shp->removed) return NULL;
+    if (shp->ds.shm_perm.seq != shmid / SHMMNI) return NULL;
+    return shp;
+}
+
+/*
+ * Permission check like a file's: 'mode' is 04 to read, 02 to write.
+ */
+static int shm_access(struct shm_segment* shp, int mode)
+{
+    int perm = shp->ds.shm_perm.mode;
+    if (!current->euid) return 0;
+    if (current->euid == shp->ds.shm_perm.uid ||
+        current->euid == shp->ds.shm_perm.cuid)
+        perm >>= 6;
+    else if (current->egid == shp->ds.shm_perm.gid ||
+             current->egid == shp->ds.shm_perm.cgid)
+        perm >>= 3;
+    return ((perm & mode) == mode) ? 0 : -EACCES;
+}
+
+static void free_shm(struct shm_segment* shp)
+{
+    for (int i = 0; i < shp->npages; ++i)
+        if (shp->pages[i]) free_page(shp->pages[i]);
+    free_page((unsigned long) shp->pages);
+    shp->pages = NULL;
+    shp->removed = false;
+}
+
+static int new_shm(key_t key, int size, int shmflg)
+{
+    struct shm_segment* shp = segments;
+    while (shp < segments + SHMMNI && shp->pages) ++shp;
+    if (shp >= segments + SHMMNI) return -ENOSPC;
+    //////////////////////////////////////////////////////////////////////////
+    unsigned long* pages = (unsigned long*) get_free_page();
+    if (!pages) return -ENOMEM;
+    if (shp->pages) {           // we slept: somebody took the slot
+        free_page((unsigned long) pages);
+        return -EAGAIN;
+    }
+    //////////////////////////////////////////////////////////////////////////
+    shp->pages = pages;         // zeroed: no page yet
+    shp->npages = (size + PAGE_SIZE - 1) >> 12;
+    shp->removed = false;
+    shp->ds.shm_perm.key = key;
+    shp->ds.shm_perm.uid = shp->ds.shm_perm.cuid = current->euid;
+    shp->ds.shm_perm.gid = shp->ds.shm_perm.cgid = current->egid;
+    shp->ds.shm_perm.mode = shmflg & 0777;
+    shp->ds.shm_perm.seq++;
+    shp->ds.shm_segsz = size;
+    shp->ds.shm_atime = shp->ds.shm_dtime = 0;
+    shp->ds.shm_ctime = CURRENT_TIME;
+    shp->ds.shm_cpid = shp->ds.shm_lpid = current->pid;
+    shp->ds.shm_nattch = 0;
+    return shm_id(shp);
+}
+
+/*
+ **************************** INTERFACE **************************************
+ */
+
+/*
+ * Page nr of the segment, got (zeroed) if nobody used it yet. The
+ * segment keeps its reference; 0 if out of memory.
+ */
+unsigned long shm_page(struct shm_segment* shp, unsigned long nr)
+{
+    if (nr >= shp->npages) return 0;
+    if (shp->pages[nr]) return shp->pages[nr];
+    //////////////////////////////////////////////////////////////////////////
+    unsigned long page = get_free_page();
+    if (!page) return 0;
+    if (shp->pages[nr]) {       // we slept: somebody else got it
+        free_page(page);
+        return shp->pages[nr];
+    }
+    return shp->pages[nr] = page;
+}
+
+/* a task attaches the segment, or gets it by fork() */
+void shm_attach(struct shm_segment* shp)
+{
+    shp->ds.shm_nattch++;
+    shp->ds.shm_atime = CURRENT_TIME;
+    shp->ds.shm_lpid = current->pid;
+}
+
+void shm_detach(struct shm_segment* shp)
+{
+    shp->ds.shm_dtime = CURRENT_TIME;
+    shp->ds.shm_lpid = current->pid;
+    if (!--shp->ds.shm_nattch && shp->removed) free_shm(shp);
+}
+
+int sys_shmget(key_t key, int size, int shmflg)
+{
+    if (size < 0 || size > SHMMAX) return -EINVAL;
+    //////////////////////////////////////////////////////////////////////////
+    if (key != IPC_PRIVATE)
+        for (struct shm_segment* shp = segments; shp < segments + SHMMNI;
+             ++shp) {
+            if (!shp->pages || shp->removed || shp->ds.shm_perm.key != key)
+                continue;
+            /***************************************************************/
+            if ((shmflg & IPC_CREAT) && (shmflg & IPC_EXCL)) return -EEXIST;
+            if (size > shp->ds.shm_segsz) return -EINVAL;
+            int error = shm_access(shp, (shmflg >> 6) & 06);
+            if (error) return error;
+            return shm_id(shp);
+        }
+    //////////////////////////////////////////////////////////////////////////
+    if (key != IPC_PRIVATE && !(shmflg & IPC_CREAT)) return -ENOENT;
+    if (size < SHMMIN) return -EINVAL;
+    return new_shm(key, size, shmflg);
+}
+
+/*
+ * Attaches the segment at shmaddr (page aligned), or wherever there is
+ * room if shmaddr is NULL. Returns the address in the data segment.
+ */
+int sys_shmat(int shmid, unsigned long shmaddr, int shmflg)
+{
+    struct shm_segment* shp = find_shm(shmid);
+    if (!shp) return -EINVAL;
+    int prot = (shmflg & SHM_RDONLY) ? PROT_READ : PROT_READ | PROT_WRITE;
+    int error = shm_access(shp, (shmflg & SHM_RDONLY) ? 04 : 06);
+    if (error) return error;
+    //////////////////////////////////////////////////////////////////////////
+    struct mmap_area* m;
+    long res = new_mmap(shmaddr, shp->npages << 12, shmaddr != 0, &m);
+    if (res < 0) return res;
+    if (!find_shm(shmid)) return -EIDRM;    // removed while we unmapped
+    /***************************************************************/
+    m->offset = 0;
+    m->shm = shp;
+    m->prot = prot;
+    m->flags = MAP_SHARED;
+    shm_attach(shp);
+    return res;
+}
+
+/*
+ * Detaches the segment attached at shmaddr.
+ */
+int sys_shmdt(unsigned long shmaddr)
+{
+    struct mmap_area* m = find_mmap(current, shmaddr, shmaddr + 1);
+    if (!m || !m->shm || m->start != shmaddr) return -EINVAL;
+    //////////////////////////////////////////////////////////////////////////
+    return do_munmap(m->start, m->end);
+}
+
+int sys_shmctl(int shmid, int cmd, struct shmid_ds* buf)
+{
+    struct shm_segment* shp = find_shm(shmid);
+    if (!shp) return -EINVAL;
+    //////////////////////////////////////////////////////////////////////////
+    switch (cmd) {
+        case IPC_STAT: {
+            int error = shm_access(shp, 04);
+            if (error) return error;
+            copy_to_user(&shp->ds, buf, struct shmid_ds);
+            return 0;
+        }
+        case IPC_SET:
+        case IPC_RMID:
+            if (current->euid && current->euid != shp->ds.shm_perm.uid &&
+                current->euid != shp->ds.shm_perm.cuid)
+                return -EPERM;
+            if (cmd == IPC_SET) {
+                shp->ds.shm_perm.uid = get_fs_word(&buf->shm_perm.uid);
+                shp->ds.shm_perm.gid = get_fs_word(&buf->shm_perm.gid);
+                shp->ds.shm_perm.mode = get_fs_word(&buf->shm_perm.mode)
+                                        & 0777;
+                shp->ds.shm_ctime = CURRENT_TIME;
+                return 0;
+            }
+            shp->removed = true;
+            shp->ds.shm_perm.key = IPC_PRIVATE;
+            if (!shp->ds.shm_nattch) free_shm(shp);
+            return 0;
+        default:
+            return -EINVAL;
+    }
+}
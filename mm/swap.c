@@ -0,0 +1,198 @@
+/*
+ *  linux/mm/swap.c
+ *
+ *  (C) 1991  Linus Torvalds
+ */
+
+/*
+ * This file handles the swap area: sys_swapon(), the allocation of swap
+ * pages and moving pages between memory and the swap area. Choosing the
+ * pages to swap out is done in memory.c, next to the page tables.
+ *
+ * There is one swap area, a block device or a regular file. Its first
+ * page is a bitmap of the usable pages (bit set: free), with the
+ * signature "SWAP-SPACE" in its last 10 bytes. Page I/O goes through the
+ * buffer cache, so a page written out stays in the cache until bdflush
+ * gets to it, and is read back from there if it is wanted again soon.
+ */
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <asm/system.h>
+
+#define SWAP_BITS (4096 << 3)
+#define SWAP_SIGNATURE (4096 - 10)
+
+static unsigned long* swap_bitmap = NULL;
+static int swap_dev = 0;
+static struct m_inode* swap_file = NULL;   /* NULL: swapping to swap_dev */
+static int nr_swap_pages = 0;              /* free ones */
+
+/* page I/O sleeps in the buffer cache: one page in flight at a time */
+static int swap_lock = 0;
+static struct task_struct* swap_wait = NULL;
+
+#define bit(nr, addr) \
+    ({ \
+        register int __res; \
+        __asm__ __volatile__ ("btl %2, %3\n\t" \
+                              "setb %%al\n\t" \
+                              : \
+                              "=a" (__res) \
+                              : \
+                              "0" (0), \
+                              "r" (nr), \
+                              "m" (*(addr)) \
+                             ); \
+        __res; \
+    })
+
+static inline void lock_swap(void)
+{
+    while (swap_lock) sleep_on(&swap_wait);
+    swap_lock = 1;
+}
+
+static inline void unlock_swap(void)
+{
+    swap_lock = 0;
+    wake_up(&swap_wait);
+}
+
+/*
+ * The four blocks of swap page nr. For a swap file they are looked up
+ * through the file, which sys_swapon() checked has no holes.
+ */
+static void swap_blocks(int nr, int b[4])
+{
+    for (int i = 0; i < 4; ++i) {
+        b[i] = nr * 4 + i;
+        if (swap_file) b[i] = bmap(swap_file, b[i]);
+    }
+}
+
+/*
+ **************************** INTERFACE **************************************
+ */
+
+void read_swap_page(int nr, unsigned long page)
+{
+    int b[4];
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+    lock_swap();
+    swap_blocks(nr, b);
+    bread_page(page, swap_dev, b);
+    unlock_swap();
+}
+
+void write_swap_page(int nr, unsigned long page)
+{
+    int b[4];
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+    lock_swap();
+    swap_blocks(nr, b);
+    bwrite_page(page, swap_dev, b);
+    unlock_swap();
+}
+
+/*
+ * Returns a free swap page, 0 if there is none (page 0 is the header).
+ */
+int get_swap_page(void)
+{
+    if (!swap_bitmap) return 0;
+    //////////////////////////////////////////////////////////////////////////
+    for (int i = 0; i < SWAP_BITS/32; ++i) {
+        if (!swap_bitmap[i]) continue;
+        /***************************************************************/
+        int nr;
+        __asm__ ("bsfl %1, %0\n\t" : "=r" (nr) : "r" (swap_bitmap[i]));
+        swap_bitmap[i] &= ~(1UL << nr);
+        --nr_swap_pages;
+        return i * 32 + nr;
+    }
+    return 0;
+}
+
+void swap_free(int nr)
+{
+    if (!swap_bitmap || nr <= 0 || nr >= SWAP_BITS) {
+        printk("swap_free: bad swap page %d\n\r", nr);
+        return;
+    }
+    if (bit(nr, swap_bitmap)) {
+        printk("swap_free: swap page %d already free\n\r", nr);
+        return;
+    }
+    swap_bitmap[nr >> 5] |= 1UL << (nr & 31);
+    ++nr_swap_pages;
+}
+
+int sys_swapon(const char* specialfile)
+{
+    if (!suser()) return -EPERM;
+    if (swap_bitmap) return -EBUSY;     // only one swap area
+    //////////////////////////////////////////////////////////////////////////
+    struct m_inode* inode = namei(specialfile);
+    if (!inode) return -ENOENT;
+    //;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+    if (S_ISBLK(inode->i_mode)) {
+        swap_dev = inode->i_zone[0];
+        iput(inode);
+    }
+    else if (S_ISREG(inode->i_mode)) {
+        swap_dev = inode->i_dev;
+        swap_file = inode;              // keep it: we bmap() through it
+    }
+    else {
+        iput(inode);
+        return -EINVAL;
+    }
+    //////////////////////////////////////////////////////////////////////////
+    unsigned long* bitmap = (unsigned long*) get_free_page();
+    if (!bitmap) {
+        if (swap_file) iput(swap_file);
+        swap_file = NULL;
+        return -ENOMEM;
+    }
+    read_swap_page(0, (unsigned long) bitmap);
+    if (strncmp("SWAP-SPACE", SWAP_SIGNATURE + (char*) bitmap, 10)) {
+        printk("Unable to find swap-space signature\n\r");
+        free_page((unsigned long) bitmap);
+        if (swap_file) iput(swap_file);
+        swap_file = NULL;
+        return -EINVAL;
+    }
+    memset(SWAP_SIGNATURE + (char*) bitmap, 0, 10);
+    //////////////////////////////////////////////////////////////////////////
+    // the header isn't ours to use, nor are pages a swap file can't back
+    bitmap[0] &= ~1UL;
+    int count = 0;
+    for (int nr = 1; nr < SWAP_BITS; ++nr) {
+        if (!bit(nr, bitmap)) continue;
+        if (swap_file) {
+            int b[4];
+            swap_blocks(nr, b);
+            if (!b[0] || !b[1] || !b[2] || !b[3]) {
+                bitmap[nr >> 5] &= ~(1UL << (nr & 31));
+                continue;
+            }
+        }
+        ++count;
+    }
+    if (!count) {
+        printk("Empty swap-file\n\r");
+        free_page((unsigned long) bitmap);
+        if (swap_file) iput(swap_file);
+        swap_file = NULL;
+        return -EINVAL;
+    }
+    //////////////////////////////////////////////////////////////////////////
+    nr_swap_pages = count;
+    swap_bitmap = bitmap;
+    printk("Adding Swap: %d pages (%d bytes) swap-space\n\r", count, count*4096);
+    return 0;
+}